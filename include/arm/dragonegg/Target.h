@@ -36,7 +36,15 @@
 
 #define TARGET_ADJUST_LLVM_CC(CC, type)                                        \
   {                                                                            \
-    if (TARGET_AAPCS_BASED) {                                                  \
+    tree pcs = lookup_attribute("pcs", TYPE_ATTRIBUTES(type));                 \
+    if (TARGET_AAPCS_BASED && pcs) {                                           \
+      /* The pcs attribute overrides the -mfloat-abi calling convention. */    \
+      if (!strcmp(TREE_STRING_POINTER(TREE_VALUE(TREE_VALUE(pcs))),            \
+                  "aapcs-vfp"))                                                \
+        CC = CallingConv::ARM_AAPCS_VFP;                                       \
+      else                                                                     \
+        CC = CallingConv::ARM_AAPCS;                                           \
+    } else if (TARGET_AAPCS_BASED) {                                           \
       if (TARGET_VFP && TARGET_HARD_FLOAT_ABI &&                               \
           ((TYPE_ARG_TYPES(type) == 0) ||                                      \
            (TREE_VALUE(tree_last(TYPE_ARG_TYPES(type))) == void_type_node)))   \
@@ -79,12 +87,12 @@ llvm_arm_aggr_type_for_struct_return(tree_node *type, CallingConv::ID CC);
   llvm_arm_aggr_type_for_struct_return((X), (CC))
 
 extern void llvm_arm_extract_multiple_return_value(
-    Value *Src, Value *Dest, bool isVolatile, LLVMBuilder &B);
+    Value *Src, Value *Dest, unsigned Align, bool isVolatile, LLVMBuilder &B);
 
 /* LLVM_EXTRACT_MULTIPLE_RETURN_VALUE - Extract multiple return value from
-  SRC and assign it to DEST. */
-#define LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Src, Dest, V, B)                    \
-  llvm_arm_extract_multiple_return_value((Src), (Dest), (V), (B))
+  SRC and assign it to DEST, which is aligned to A bytes. */
+#define LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Src, Dest, A, V, B)                 \
+  llvm_arm_extract_multiple_return_value((Src), (Dest), (A), (V), (B))
 
 extern bool llvm_arm_should_pass_or_return_aggregate_in_regs(
     tree_node *TreeType, CallingConv::ID CC);
@@ -107,7 +115,20 @@ extern bool llvm_arm_should_pass_or_return_aggregate_in_regs(
  */
 #define LLVM_TARGET_NAME ARM
 
-/* Turn -march=xx into a CPU type.
+/* Whether the architecture has hardware integer division in Thumb and in ARM
+ * mode.
+ */
+#if (GCC_MINOR > 7)
+#define LLVM_ARM_THUMB_HWDIV arm_arch_thumb_hwdiv
+#define LLVM_ARM_ARM_HWDIV arm_arch_arm_hwdiv
+#else
+#define LLVM_ARM_THUMB_HWDIV arm_arch_hwdiv
+#define LLVM_ARM_ARM_HWDIV 0
+#endif
+
+/* Turn -mtune=xx into a CPU type, which decides how code is scheduled.  The
+ * instruction set is given by -march, so the architecture features are listed
+ * explicitly to stop the CPU enabling instructions -march does not allow.
  */
 #define LLVM_SET_SUBTARGET_FEATURES(C, F)                                      \
   {                                                                            \
@@ -251,6 +272,15 @@ extern bool llvm_arm_should_pass_or_return_aggregate_in_regs(
       C = ("arm7tdmi");                                                        \
       break;                                                                   \
     }                                                                          \
+    F.AddFeature("v4t", arm_arch4t);                                           \
+    F.AddFeature("v5t", arm_arch5);                                            \
+    F.AddFeature("v5te", arm_arch5e);                                          \
+    F.AddFeature("v6", arm_arch6);                                             \
+    F.AddFeature("v6t2", arm_arch_thumb2);                                     \
+    F.AddFeature("v7", arm_arch7);                                             \
+    F.AddFeature("thumb2", arm_arch_thumb2);                                   \
+    F.AddFeature("hwdiv", LLVM_ARM_THUMB_HWDIV);                               \
+    F.AddFeature("hwdiv-arm", LLVM_ARM_ARM_HWDIV);                             \
     F.AddFeature("vfp3", TARGET_VFP3);                                         \
     if (!TARGET_VFP3)                                                          \
       F.AddFeature("vfp2", TARGET_VFP && TARGET_HARD_FLOAT);                   \
@@ -306,8 +336,8 @@ extern bool llvm_arm_should_pass_or_return_aggregate_in_regs(
 #define LLVM_SET_TARGET_MACHINE_OPTIONS(options)                               \
   do {                                                                         \
     options.UseSoftFloat = TARGET_SOFT_FLOAT;                                  \
-    if (TARGET_HARD_FLOAT_ABI)                                                 \
-      options.FloatABIType = llvm::FloatABI::Hard;                             \
+    options.FloatABIType =                                                     \
+        TARGET_HARD_FLOAT_ABI ? llvm::FloatABI::Hard : llvm::FloatABI::Soft;   \
   } while (0)
 
 /* These are a couple of extensions to the asm formats
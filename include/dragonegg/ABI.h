@@ -31,8 +31,10 @@
 #include "dragonegg/TypeConversion.h"
 
 // LLVM headers
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/MathExtras.h"
 
 namespace llvm { class BasicBlock; }
 
@@ -275,18 +277,38 @@ inline llvm::Type *getLLVMAggregateTypeForStructReturn(tree_node */*type*/) {
 #endif
 
 // LLVM_EXTRACT_MULTIPLE_RETURN_VALUE - Extract multiple return value from
-// SRC and assign it to DEST. Each target that supports multiple return
-// value must implement this hook.
+// SRC and assign it to DEST, which is aligned to A bytes. Each target that
+// supports multiple return value must implement this hook.
 #ifndef LLVM_EXTRACT_MULTIPLE_RETURN_VALUE
-#define LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Src, Dest, V, B)                    \
-  llvm_default_extract_multiple_return_value((Src), (Dest), (V), (B))
+#define LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Src, Dest, A, V, B)                 \
+  llvm_default_extract_multiple_return_value((Src), (Dest), (A), (V), (B))
 #endif
 inline void llvm_default_extract_multiple_return_value(
-    llvm::Value */*Src*/, llvm::Value */*Dest*/, bool /*isVolatile*/,
-    LLVMBuilder &/*Builder*/) {
+    llvm::Value */*Src*/, llvm::Value */*Dest*/, unsigned /*Align*/,
+    bool /*isVolatile*/, LLVMBuilder &/*Builder*/) {
   llvm_unreachable("LLVM_EXTRACT_MULTIPLE_RETURN_VALUE is not implemented!");
 }
 
+// StoreMultipleReturnValuePiece - Helper for LLVM_EXTRACT_MULTIPLE_RETURN_VALUE
+// implementations.  Store VAL, a piece of a multiple return value, into the
+// part of DEST selected by the field and element numbers IDXS, as for a GEP
+// with a leading zero index.  DEST is aligned to ALIGN bytes; the store gets
+// the alignment that this implies for the part being written.
+inline void StoreMultipleReturnValuePiece(llvm::Value *Val, llvm::Value *Dest,
+                                          llvm::ArrayRef<unsigned> Idxs,
+                                          unsigned Align, bool isVolatile,
+                                          LLVMBuilder &Builder) {
+  llvm::Type *Int32Ty = llvm::Type::getInt32Ty(llvm::getGlobalContext());
+  llvm::SmallVector<llvm::Value *, 4> GEPIdxs;
+  GEPIdxs.push_back(llvm::ConstantInt::get(Int32Ty, 0));
+  for (unsigned i = 0, e = Idxs.size(); i != e; ++i)
+    GEPIdxs.push_back(llvm::ConstantInt::get(Int32Ty, Idxs[i]));
+  uint64_t Offset = getDataLayout().getIndexedOffset(Dest->getType(), GEPIdxs);
+  llvm::Value *GEP = Builder.CreateInBoundsGEP(Dest, GEPIdxs, "mrv_gep");
+  Builder.CreateAlignedStore(Val, GEP, llvm::MinAlign(Align, Offset),
+                             isVolatile);
+}
+
 /// DefaultABI - This class implements the default LLVM ABI where structures are
 /// passed by decimating them into individual components and unions are passed
 /// by passing the largest member of the union.
@@ -172,7 +172,8 @@ private:
       llvm::DIFile F, unsigned LineNumber, uint64_t SizeInBits,
       uint64_t AlignInBits, uint64_t OffsetInBits, unsigned Flags,
       llvm::DIType DerivedFrom, llvm::DIArray Elements,
-      unsigned RunTimeLang = 0, llvm::MDNode *ContainingType = 0);
+      unsigned RunTimeLang = 0, llvm::MDNode *ContainingType = 0,
+      llvm::StringRef UniqueIdentifier = llvm::StringRef());
 
   /// CreateSubprogram - Create a new descriptor for the specified subprogram.
   /// See comments in DISubprogram for descriptions of these fields.
@@ -94,6 +94,11 @@ extern bool flag_odr;
 /// the arguments given in the function type.
 extern bool flag_functions_from_args;
 
+/// ComputedGotoUnfactorLimit - The maximum number of indirect branch
+/// destinations that may be added when giving each computed goto its own
+/// indirect branch.  Zero means computed gotos are never unfactored.
+extern unsigned ComputedGotoUnfactorLimit;
+
 /// AttributeUsedGlobals - The list of globals that are marked attribute(used).
 extern llvm::SmallSetVector<llvm::Constant *, 32> AttributeUsedGlobals;
 
@@ -135,6 +140,15 @@ void changeLLVMConstant(llvm::Constant *Old, llvm::Constant *New);
 void register_ctor_dtor(llvm::Function *, int, bool);
 const char *extractRegisterName(tree_node *);
 void handleVisibility(tree_node *decl, llvm::GlobalValue *GV);
+void handleLocalBinding(tree_node *decl, llvm::GlobalValue *GV);
+
+/// FoldBuiltinConstantP - Resolve the calls to __builtin_constant_p in F whose
+/// argument has become constant.  If Final, resolve all of them.
+bool FoldBuiltinConstantP(llvm::Function &F, bool Final);
+
+/// FinishBuiltinConstantP - Resolve all remaining calls to __builtin_constant_p
+/// in the module.
+void FinishBuiltinConstantP(llvm::Module &M);
 
 /// Return true if and only if field no. N from struct type T is a padding
 /// element added to match llvm struct type size and gcc struct type size.
@@ -237,8 +251,13 @@ class TreeToLLVM {
   // definitions.
   llvm::Instruction *SSAInsertionPoint;
 
-  /// BasicBlocks - Map from GCC to LLVM basic blocks.
-  llvm::DenseMap<basic_block_def *, llvm::BasicBlock *> BasicBlocks;
+  /// BasicBlocks - The LLVM basic block for each GCC basic block, indexed by
+  /// the GCC basic block number, or null if not created yet.
+  std::vector<llvm::BasicBlock *> BasicBlocks;
+
+  /// LabelBlocks - The LLVM basic block for each label in the function body,
+  /// indexed by LABEL_DECL_UID, or null if not looked up yet.
+  std::vector<llvm::BasicBlock *> LabelBlocks;
 
   /// LocalDecls - Map from local declarations to their associated LLVM values.
   llvm::DenseMap<tree_node *, llvm::AssertingVH<llvm::Value> > LocalDecls;
@@ -249,6 +268,17 @@ class TreeToLLVM {
   // SSANames - Map from GCC ssa names to the defining LLVM value.
   llvm::DenseMap<tree_node *, llvm::TrackingVH<llvm::Value> > SSANames;
 
+  /// ScalarizedLocals - Map from local aggregates whose fields are held in
+  /// separate locals, rather than in the memory of the aggregate, to the local
+  /// for each field (indexed by LLVM field number, created on first use).  The
+  /// field locals are promoted to registers when the function is complete.
+  llvm::DenseMap<tree_node *, llvm::SmallVector<llvm::AllocaInst *, 4> >
+  ScalarizedLocals;
+
+  /// ScalarizedFieldLocals - The field locals of scalarized aggregates, in the
+  /// order they were created.
+  llvm::SmallVector<llvm::AllocaInst *, 16> ScalarizedFieldLocals;
+
 public:
 
   //===---------------------- Local Declarations --------------------------===//
@@ -454,6 +484,33 @@ private : // Helpers for exception handling.
 private:
   void EmitAutomaticVariableDecl(tree_node *decl);
 
+  /// FindScalarizableLocals - Work out which local aggregates are only used in
+  /// ways that allow their fields to be held in registers.
+  void FindScalarizableLocals();
+
+  /// isScalarizedLocal - Whether the given expression is a local aggregate
+  /// whose fields are held in separate locals.
+  bool isScalarizedLocal(tree_node *exp) const {
+    return ScalarizedLocals.count(exp);
+  }
+
+  /// getScalarizedFieldLoc - Return the local holding the given field of the
+  /// scalarized local aggregate decl.
+  MemRef getScalarizedFieldLoc(tree_node *decl, tree_node *Field);
+
+  /// getAggregateFieldLoc - Return the location of the given field of exp,
+  /// which is either a scalarized local or an aggregate in memory at Loc.
+  MemRef getAggregateFieldLoc(tree_node *exp, MemRef Loc, tree_node *Field);
+
+  /// EmitScalarizedAggregateCopy - Assign rhs to lhs, where at least one of
+  /// them is a scalarized local.  If rhs is an empty constructor then lhs is
+  /// zeroed.
+  void EmitScalarizedAggregateCopy(tree_node *lhs, tree_node *rhs);
+
+  /// PromoteScalarizedLocals - Turn the field locals of scalarized aggregates
+  /// into registers.
+  void PromoteScalarizedLocals();
+
   /// EmitAnnotateIntrinsic - Emits call to annotate attr intrinsic
   void EmitAnnotateIntrinsic(llvm::Value *V, tree_node *decl);
 
@@ -479,6 +536,13 @@ private:
   /// EmitAssignRHS - Convert the RHS of a scalar GIMPLE_ASSIGN to LLVM.
   llvm::Value *EmitAssignRHS(gimple_statement_d *stmt);
 
+  /// EmitRotate - Rotate a value left or right by the given number of bits.
+  llvm::Value *EmitRotate(llvm::Value *In, llvm::Value *Amt, bool isLeftRotate);
+
+  /// EmitRecognizedIdiom - If the assignment completes a recognized bit
+  /// manipulation idiom, emit it using the equivalent intrinsic.
+  llvm::Value *EmitRecognizedIdiom(gimple_statement_d *stmt);
+
   /// EmitAssignSingleRHS - Helper for EmitAssignRHS.  Handles those RHS that
   /// are not register expressions.
   llvm::Value *EmitAssignSingleRHS(tree_node *rhs);
@@ -540,7 +604,7 @@ private:
   llvm::Value *EmitReg_ReducMinMaxExpr(tree_node *op, unsigned UIPred,
                                        unsigned SIPred, unsigned Opc);
   llvm::Value *EmitReg_RotateOp(tree_node *type, tree_node *op0, tree_node *op1,
-                                unsigned Opc1, unsigned Opc2);
+                                bool isLeftRotate);
   llvm::Value *EmitReg_ShiftOp(tree_node *op0, tree_node *op1, unsigned Opc);
   llvm::Value *EmitReg_VecShiftOp(tree_node *op0, tree_node *op1,
                                   bool isLeftShift);
@@ -600,6 +664,11 @@ private:
 #endif
   llvm::Value *EmitCallOf(llvm::Value *Callee, gimple_statement_d *stmt,
                           const MemRef *DestLoc, const llvm::AttributeSet &PAL);
+  llvm::Value *EmitPromotedIndirectCall(
+      llvm::Value *Callee, llvm::ArrayRef<llvm::Value *> Ops,
+      llvm::CallingConv::ID CC, const llvm::AttributeSet &PAL,
+      llvm::ArrayRef<std::pair<llvm::Function *, uint64_t> > Targets,
+      uint64_t Total);
   llvm::CallInst *EmitSimpleCall(llvm::StringRef CalleeName,
                                  tree_node *ret_type,
                                  /* arguments */ ...) LLVM_END_WITH_NULL;
@@ -768,6 +837,12 @@ private:
                             llvm::Type *ResultType,
                             std::vector<llvm::Value *> &Ops);
 
+  // Optional target defined lowering of the high or low half of a widening
+  // vector multiply.
+  bool TargetVecWidenMult(llvm::Type *ResultType, llvm::Value *LHS,
+                          llvm::Value *RHS, bool isHigh, bool isSigned,
+                          llvm::Value *&Result);
+
 public:
   // Helper for taking the address of a label.
   llvm::Constant *AddressOfLABEL_DECL(tree_node *exp);
@@ -0,0 +1,157 @@
+//=----------- Profile.h - Profile instrumentation and feedback ---*- C++ -*-=//
+//
+// Copyright (C) 2013  Duncan Sands et al.
+//
+// This file is part of DragonEgg.
+//
+// DragonEgg is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2, or (at your option) any later version.
+//
+// DragonEgg is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// DragonEgg; see the file COPYING.  If not, write to the Free Software
+// Foundation, 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+//
+//===----------------------------------------------------------------------===//
+// This file declares routines for instrumenting code to collect execution
+// profiles, and for using the resulting profiles to guide optimization.
+//
+// Edge profiles are collected using LLVM's instrumentation based profiling, so
+// they are written by the LLVM profile runtime and can be merged and inspected
+// with llvm-profdata.  The counters of each function are: the number of times
+// the function was entered, followed by the number of times each outgoing edge
+// of each conditional branch or switch was taken, in the order the blocks and
+// edges appear in the function as initially converted.
+//
+// Indirect calls are profiled separately, since the LLVM profile format does
+// not support recording values.  The indirect call profile file consists of
+// any number of blocks, one for each instrumented compilation unit that was
+// run.  Blocks are appended to the file when the program exits, so the file
+// accumulates the results of every training run.  All fields are in the byte
+// order of the machine that ran the program, and are naturally aligned:
+//
+//   uint32_t Magic;          // 0x44454943 ('DEIC').
+//   uint32_t Version;        // Currently 1.
+//   uint64_t RunID;          // Identifies the run: time << 32 | process ID.
+//   uint32_t NumFunctions;
+//   uint32_t NumSites;
+//   struct {
+//     uint64_t Address;      // Run-time address of the function.
+//     uint64_t NameHash;     // Hash of the function name, see below.
+//   } Functions[NumFunctions];
+//   struct {
+//     uint64_t SiteID;       // Identifies the call site, see below.
+//     struct {
+//       uint64_t Address;    // Run-time address of the target, or zero.
+//       uint64_t Count;      // Number of calls to that target.
+//     } Targets[ICallTargetsPerSite];
+//     uint64_t OtherCount;   // Calls to targets not listed above.
+//   } Sites[NumSites];
+//
+// Functions lists every function defined in the compilation unit.  When the
+// profile is read, the addresses of called functions are turned back into
+// names using the function tables written by the same process.  NameHash is
+// the low 64 bits of the MD5 of the function's symbol name, prefixed by the
+// name of the source file and a colon if the function is local.  SiteID is
+// computed in the same way from the name of the function containing the call
+// followed by '/' and the index of the indirect call within that function.
+//===----------------------------------------------------------------------===//
+
+#ifndef DRAGONEGG_PROFILE_H
+#define DRAGONEGG_PROFILE_H
+
+// LLVM headers
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CallingConv.h"
+
+// System headers
+#include <stdint.h>
+#include <string>
+
+namespace llvm {
+class Constant;
+class Function;
+class FunctionType;
+}
+
+//===----------------------------------------------------------------------===//
+//                             ... Edge Profiles ...
+//===----------------------------------------------------------------------===//
+
+/// ProfileGenerate - Whether to instrument functions to count how often each
+/// branch is taken.
+extern bool ProfileGenerate;
+
+/// ProfileAtomicCounters - Whether profile counters should be incremented
+/// atomically, giving exact counts for multi-threaded programs.
+extern bool ProfileAtomicCounters;
+
+/// LoadEdgeProfile - Read in an edge profile produced by llvm-profdata merge.
+/// Returns false and sets Error if the profile could not be read.
+bool LoadEdgeProfile(const char *FileName, std::string &Error);
+
+/// InstrumentEdges - Instrument a newly converted function to count how often
+/// it is called and how often each branch is taken.
+void InstrumentEdges(llvm::Function *F);
+
+/// ApplyEdgeProfile - Annotate the branches of a newly converted function with
+/// the weights given by the edge profile, if it has one.
+void ApplyEdgeProfile(llvm::Function *F);
+
+/// FinishEdgeProfile - Lower the profile instrumentation in the current module
+/// to counters and calls to the LLVM profile runtime.
+void FinishEdgeProfile();
+
+//===----------------------------------------------------------------------===//
+//                        ... Indirect Call Profiles ...
+//===----------------------------------------------------------------------===//
+
+/// ICallTargetsPerSite - The number of different targets recorded for each
+/// indirect call site.
+const unsigned ICallTargetsPerSite = 4;
+
+/// ICallProfileGenerateFile - If not null, indirect calls are instrumented and
+/// the profile is appended to this file when the program exits.
+extern const char *ICallProfileGenerateFile;
+
+/// ICallProfileUseFile - If not null, the profile read from this file is used
+/// to turn frequently taken indirect calls into direct calls.
+extern const char *ICallProfileUseFile;
+
+/// LoadIndirectCallProfile - Read in the indirect call profile from the given
+/// file.  Returns false and sets Error if the profile could not be read.
+bool LoadIndirectCallProfile(const char *FileName, std::string &Error);
+
+/// getIndirectCallSiteID - Return an identifier for the next indirect call in
+/// the given function.
+uint64_t getIndirectCallSiteID(llvm::Function *F);
+
+/// getIndirectCallCounters - Return the counters for the given call site, to
+/// be passed to the function returned by getIndirectCallRecorder.
+llvm::Constant *getIndirectCallCounters(uint64_t SiteID);
+
+/// getIndirectCallRecorder - Return a function that takes a call site's
+/// counters and the address of the called function and updates the counters.
+llvm::Function *getIndirectCallRecorder();
+
+/// getIndirectCallTargets - Return the functions in the current module that
+/// are called often enough from the given site to be worth calling directly,
+/// most frequent first.  Only functions of the given type and calling
+/// convention are considered.  Total is set to the total number of calls made
+/// from the site.
+void getIndirectCallTargets(
+    uint64_t SiteID, llvm::FunctionType *FTy, llvm::CallingConv::ID CC,
+    llvm::SmallVectorImpl<std::pair<llvm::Function *, uint64_t> > &Targets,
+    uint64_t &Total);
+
+/// FinishIndirectCallProfile - Output the tables holding the indirect call
+/// profile for the current module.  Returns a function that writes the profile
+/// out, which should be run when the program exits, or null if nothing in the
+/// module was instrumented.
+llvm::Function *FinishIndirectCallProfile();
+
+#endif /* DRAGONEGG_PROFILE_H */
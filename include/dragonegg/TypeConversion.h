@@ -53,6 +53,25 @@ extern uint64_t ArrayLengthOf(tree_node *type);
 /// INT_MAX if there is no such LLVM field.
 int GetFieldIndex(tree_node *decl, llvm::Type *Ty);
 
+/// FieldLayout - Where a FIELD_DECL lies within its record.  This is worked out
+/// once per field, when the record is converted, rather than on every access.
+struct FieldLayout {
+  /// Index - The LLVM field index, as returned by GetFieldIndex.
+  int Index;
+  /// BitOffset - DECL_FIELD_BIT_OFFSET, the offset of the field in bits from
+  /// the position given by DECL_FIELD_OFFSET.
+  uint64_t BitOffset;
+  /// Alignment - The alignment in octets of the octet containing the first bit
+  /// of the field, as returned by getFieldAlignment.
+  unsigned Alignment;
+  /// Bitfield - Whether the field should be treated as a bitfield.
+  bool Bitfield;
+};
+
+/// GetFieldLayout - Return the layout of the field declaration 'decl' within
+/// the given LLVM type, which should be the type of the containing record.
+FieldLayout GetFieldLayout(tree_node *decl, llvm::Type *Ty);
+
 /// GetUnitType - Returns an integer one address unit wide if 'NumUnits' is 1;
 /// otherwise returns an array of such integers with 'NumUnits' elements.  For
 /// example, on a machine which has 16 bit bytes returns an i16 or an array of
@@ -23,7 +23,10 @@
 #ifndef DRAGONEGG_TARGET_H
 #define DRAGONEGG_TARGET_H
 
-namespace llvm { class SubtargetFeatures; }
+namespace llvm {
+class Function;
+class SubtargetFeatures;
+}
 
 /* LLVM specific stuff for supporting calling convention output */
 #define TARGET_ADJUST_LLVM_CC(CC, type)                                        \
@@ -141,12 +144,13 @@ extern llvm::Type *llvm_x86_aggr_type_for_struct_return(tree_node *type);
   llvm_x86_aggr_type_for_struct_return(X)
 
 extern void llvm_x86_extract_multiple_return_value(
-    llvm::Value *Src, llvm::Value *Dest, bool isVolatile, LLVMBuilder &B);
+    llvm::Value *Src, llvm::Value *Dest, unsigned Align, bool isVolatile,
+    LLVMBuilder &B);
 
 /* LLVM_EXTRACT_MULTIPLE_RETURN_VALUE - Extract multiple return value from
-   SRC and assign it to DEST. */
-#define LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Src, Dest, V, B)                    \
-  llvm_x86_extract_multiple_return_value((Src), (Dest), (V), (B))
+   SRC and assign it to DEST, which is aligned to A bytes. */
+#define LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Src, Dest, A, V, B)                 \
+  llvm_x86_extract_multiple_return_value((Src), (Dest), (A), (V), (B))
 
 extern bool llvm_x86_should_pass_vector_using_byval_attr(tree_node *);
 
@@ -292,6 +296,14 @@ extern const char *llvm_x86_override_target_environment();
                                     OPS)                                       \
   TargetIntrinsicLower(STMT, FNDECL, DESTLOC, RESULT, DESTTY, OPS);
 
+/* LLVM_TARGET_VEC_WIDEN_MULT - Compute the high (ISHI) or low half of the
+ * widening product of two vectors using target instructions.  If the target
+ * can do this then this macro should set RESULT to the products and return
+ * true.  This macro is invoked from a method in the TreeToLLVM class.
+ */
+#define LLVM_TARGET_VEC_WIDEN_MULT(TYPE, LHS, RHS, ISHI, ISSIGNED, RESULT)     \
+  TargetVecWidenMult(TYPE, LHS, RHS, ISHI, ISSIGNED, RESULT)
+
 /* LLVM_GET_REG_NAME - When extracting a register name for a constraint, use
    the string extracted from the magic symbol built for that register, rather
    than reg_names.  The latter maps both AH and AL to the same thing, which
@@ -338,16 +350,24 @@ extern const char *llvm_x86_override_target_environment();
       argvec.push_back("-force-align-stack");                                  \
   } while (0)
 
+/* The stack is kept aligned to the -mpreferred-stack-boundary value, which is
+ * what callees may rely on.  If -mincoming-stack-boundary is smaller then the
+ * stack is realigned on entry, see llvm_x86_set_target_machine_attributes.
+ * Without an FPU, floating point operations are done by library calls.
+ */
 #define LLVM_SET_TARGET_MACHINE_OPTIONS(O)                                     \
   do {                                                                         \
     if (TARGET_OMIT_LEAF_FRAME_POINTER)                                        \
       O.NoFramePointerElim = false;                                            \
+    O.StackAlignmentOverride = PREFERRED_STACK_BOUNDARY / 8;                   \
+    O.UseSoftFloat = !TARGET_80387 && !TARGET_SSE;                             \
   } while (0)
 
+/* Per-function versions of the target machine options, and realignment of the
+ * stack for functions that may be called with a less aligned stack.
+ */
+extern void llvm_x86_set_target_machine_attributes(llvm::Function *F);
 #define LLVM_SET_TARGET_MACHINE_ATTRIBUTES(F)                                  \
-  do {                                                                         \
-    if (TARGET_OMIT_LEAF_FRAME_POINTER)                                        \
-      F->addFnAttr("no-frame-pointer-elim-non-leaf", "true");                  \
-  } while (0)
+  llvm_x86_set_target_machine_attributes(F)
 
 #endif /* DRAGONEGG_TARGET_H */
@@ -25,14 +25,19 @@
 #include "dragonegg/ConstantConversion.h"
 #include "dragonegg/Debug.h"
 #include "dragonegg/OS.h"
+#include "dragonegg/Profile.h"
 #include "dragonegg/Target.h"
 #include "dragonegg/TypeConversion.h"
 
 // LLVM headers
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/CodeGen/RegAllocRegistry.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/IRPrintingPasses.h"
 #include "llvm/IR/LLVMContext.h"
@@ -44,6 +49,7 @@
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Target/TargetLibraryInfo.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Transforms/IPO.h"
@@ -74,6 +80,7 @@ extern "C" {
 
 #include "debug.h"
 #include "diagnostic.h"
+#include "except.h"
 #include "flags.h"
 #include "gcc-plugin.h"
 #include "intl.h"
@@ -134,20 +141,52 @@ TargetFolder *TheFolder = 0;
 raw_ostream *OutStream = 0; // Stream to write assembly code to.
 formatted_raw_ostream FormattedOutStream;
 
+static bool CompressDebugSections;
 static bool DebugPassArguments;
 static bool DebugPassStructure;
 static bool EnableGCCOptimizations;
 static bool EmitIR;
 static bool EmitObj;
+static bool MergeFunctions;
+static bool NoPLT;
+static bool NoSemanticInterposition;
 static bool SaveGCCOutput;
 static int LLVMCodeGenOptimizeArg = -1;
 static int LLVMIROptimizeArg = -1;
 
+/// SelectGCCPasses - Whether the user gave a list of GCC optimization passes to
+/// run using -fplugin-arg-dragonegg-gcc-passes.
+static bool SelectGCCPasses;
+
+/// KeptGCCPasses - The GCC optimization passes the user asked to run.
+static StringSet<> KeptGCCPasses;
+
+#if (GCC_MINOR > 5)
+/// GCCPassTimers - Time spent in each GCC pass, output with -ftime-report.
+static TimerGroup *GCCPassTimers;
+static StringMap<Timer *> GCCPassTimerMap;
+static Timer *RunningGCCPassTimer;
+
+/// StopGCCPassTimer - Stop timing the current GCC pass, if any.
+static void StopGCCPassTimer() {
+  if (RunningGCCPassTimer)
+    RunningGCCPassTimer->stopTimer();
+  RunningGCCPassTimer = 0;
+}
+#endif
+
+/// EdgeProfileFile - The edge profile to use to guide optimization, if any.
+static std::string EdgeProfileFile;
+
 std::vector<std::pair<Constant *, int> > StaticCtors, StaticDtors;
 SmallSetVector<Constant *, 32> AttributeUsedGlobals;
 SmallSetVector<Constant *, 32> AttributeCompilerUsedGlobals;
 std::vector<Constant *> AttributeAnnotateGlobals;
 
+/// LocallyBoundGlobals - Definitions that GCC knows bind locally, even though
+/// LLVM would assume they might be preempted by a definition in another module.
+static SmallSetVector<Constant *, 32> LocallyBoundGlobals;
+
 /// PerFunctionPasses - This is the list of cleanup passes run per-function
 /// as each is compiled.  In cases where we are not doing IPO, it includes the
 /// code generator.
@@ -222,6 +261,11 @@ void changeLLVMConstant(Constant *Old, Constant *New) {
     AttributeCompilerUsedGlobals.insert(New);
   }
 
+  if (LocallyBoundGlobals.count(Old)) {
+    LocallyBoundGlobals.remove(Old);
+    LocallyBoundGlobals.insert(New);
+  }
+
   for (unsigned i = 0, e = StaticCtors.size(); i != e; ++i) {
     if (StaticCtors[i].first == Old)
       StaticCtors[i].first = New;
@@ -251,6 +295,111 @@ void handleVisibility(tree decl, GlobalValue *GV) {
   }
 }
 
+/// handleLocalBinding - Note that the definition of decl binds locally if GCC
+/// says so, or if -fplugin-arg-dragonegg-no-semantic-interposition allows it to
+/// be assumed, but LLVM would assume that it might be preempted.  References to
+/// such a definition are made to bypass the GOT and PLT, see BindLocally.
+void handleLocalBinding(tree decl, GlobalValue *GV) {
+  if (!flag_pic || !TREE_PUBLIC(decl) || DECL_EXTERNAL(decl))
+    return;
+  // LLVM already knows that local and non-default visibility symbols bind
+  // locally, and weak definitions may really be replaced.
+  if (!GV->hasDefaultVisibility() || GV->isWeakForLinker())
+    return;
+  // A thread local variable cannot be accessed through an alias.
+  if (isa<VAR_DECL>(decl) && DECL_THREAD_LOCAL_P(decl))
+    return;
+  if (targetm.binds_local_p(decl) || NoSemanticInterposition)
+    LocallyBoundGlobals.insert(GV);
+}
+
+/// replaceCodeUses - Make instructions that use Old, either directly or via a
+/// constant expression, use New instead.  Uses in global initializers are left
+/// alone.
+static void replaceCodeUses(Constant *Old, Constant *New) {
+  SmallVector<Use *, 8> Uses;
+  for (Use &U : Old->uses())
+    Uses.push_back(&U);
+  for (unsigned i = 0, e = Uses.size(); i != e; ++i) {
+    Use *U = Uses[i];
+    if (isa<Instruction>(U->getUser()))
+      U->set(New);
+    else if (ConstantExpr *CE = llvm::dyn_cast<ConstantExpr>(U->getUser()))
+      replaceCodeUses(CE, CE->getWithOperandReplaced(U->getOperandNo(), New));
+  }
+}
+
+/// CallThroughSlot - Have calls to the external function F load the callee from
+/// a private read-only pointer initialized to F, and call it indirectly.  The
+/// pointer is filled in by the dynamic linker when the object is loaded, just
+/// like a GOT entry, so the calls no longer go through the PLT.  Marking F with
+/// nonlazybind is not enough here: on ELF targets LLVM still calls it via @PLT.
+static void CallThroughSlot(Function *F) {
+  SmallVector<Instruction *, 8> Calls;
+  for (User *U : F->users()) {
+    if (ConstantExpr *CE = llvm::dyn_cast<ConstantExpr>(U)) {
+      if (!CE->isCast())
+        continue;
+      for (User *CU : CE->users())
+        if (isa<CallInst>(CU) || isa<InvokeInst>(CU))
+          if (CallSite(CU).getCalledValue() == CE)
+            Calls.push_back(cast<Instruction>(CU));
+    } else if (isa<CallInst>(U) || isa<InvokeInst>(U)) {
+      if (CallSite(U).getCalledValue() == F)
+        Calls.push_back(cast<Instruction>(U));
+    }
+  }
+  if (Calls.empty())
+    return;
+
+  GlobalVariable *Slot = new GlobalVariable(
+      *TheModule, F->getType(), /*isConstant*/ true,
+      GlobalValue::PrivateLinkage, F, F->getName() + ".got");
+  Slot->setUnnamedAddr(true);
+  for (unsigned i = 0, e = Calls.size(); i != e; ++i) {
+    CallSite CS(Calls[i]);
+    Value *Callee = new LoadInst(Slot, F->getName(), Calls[i]);
+    if (Callee->getType() != CS.getCalledValue()->getType())
+      Callee = CastInst::CreatePointerCast(Callee,
+                                           CS.getCalledValue()->getType(), "",
+                                           Calls[i]);
+    CS.setCalledFunction(Callee);
+  }
+}
+
+/// BindLocally - Have references to globals that bind locally go directly to
+/// the definition rather than through the GOT or PLT, and if -fno-plt was given
+/// then have calls to external functions load the callee from a GOT-like slot
+/// rather than going through the PLT.  LLVM decides this using only the linkage
+/// and visibility of the referenced global, so locally bound definitions are
+/// given a private alias, which is used in place of the global by all
+/// instructions.
+static void BindLocally() {
+  if (!Triple(TheModule->getTargetTriple()).isOSBinFormatELF())
+    return;
+
+  for (unsigned i = 0, e = LocallyBoundGlobals.size(); i != e; ++i) {
+    GlobalValue *GV =
+        llvm::dyn_cast<GlobalValue>(LocallyBoundGlobals[i]->stripPointerCasts());
+    if (!GV || GV->isDeclaration() || isa<GlobalAlias>(GV) ||
+        GV->hasLocalLinkage() || GV->use_empty())
+      continue;
+    PointerType *Ty = GV->getType();
+    GlobalAlias *GA = GlobalAlias::create(
+        Ty->getElementType(), Ty->getAddressSpace(), GlobalValue::PrivateLinkage,
+        GV->getName() + ".localalias", GV);
+    replaceCodeUses(GV, GA);
+  }
+  LocallyBoundGlobals.clear();
+
+  if (NoPLT)
+    for (Module::iterator I = TheModule->begin(), E = TheModule->end(); I != E;
+         ++I)
+      if (I->isDeclaration() && !I->isIntrinsic() && !I->hasLocalLinkage() &&
+          I->hasDefaultVisibility())
+        CallThroughSlot(&*I);
+}
+
 /// CodeGenOptLevel - The optimization level to be used by the code generators.
 static CodeGenOpt::Level CodeGenOptLevel() {
   int OptLevel =
@@ -373,6 +522,14 @@ static void ConfigureLLVM(void) {
     Args.push_back("--ffunction-sections");
   if (flag_data_sections)
     Args.push_back("--fdata-sections");
+#if (GCC_MINOR > 7)
+  if (dwarf_split_debug_info && debug_info_level > DINFO_LEVEL_NONE)
+    Args.push_back("--split-dwarf=Enable");
+#endif
+#if (GCC_MINOR > 6)
+  if (flag_debug_types_section && debug_info_level > DINFO_LEVEL_NONE)
+    Args.push_back("--generate-type-units");
+#endif
 
   // If there are options that should be passed through to the LLVM backend
   // directly from the command line, do so now.  This is mainly for debugging
@@ -502,11 +659,25 @@ static void CreateTargetMachine(const std::string &TargetTriple) {
   Options.UseInitArray = false;
 #endif
 
-  // TODO: Set float ABI type.
+  // The float ABI type is set by the target, see LLVM_SET_TARGET_MACHINE_OPTIONS.
 
-  // TODO: Set FP fusion mode.
+  // Set FP fusion mode.  GCC's default (-ffp-contract=fast) allows a multiply
+  // and an add to be fused even if they are in different statements.
+#if (GCC_MINOR > 5)
+  switch (flag_fp_contract_mode) {
+  case FP_CONTRACT_OFF:
+    Options.AllowFPOpFusion = FPOpFusion::Strict;
+    break;
+  case FP_CONTRACT_ON:
+    Options.AllowFPOpFusion = FPOpFusion::Standard;
+    break;
+  case FP_CONTRACT_FAST:
+    Options.AllowFPOpFusion = FPOpFusion::Fast;
+    break;
+  }
+#endif
 
-  // TODO: LessPreciseFPMADOption.
+  Options.LessPreciseFPMADOption = flag_unsafe_math_optimizations;
   Options.NoInfsFPMath = flag_finite_math_only;
   Options.NoNaNsFPMath = flag_finite_math_only;
   Options.NoZerosInBSS = !flag_zero_initialized_in_bss;
@@ -516,9 +687,8 @@ static void CreateTargetMachine(const std::string &TargetTriple) {
 #else
   fast_math_flags_set_p();
 #endif
-  // TODO: UseSoftFloat.
-  // TODO: StackAlignmentOverride.
-  // TODO: RealignStack.
+  // UseSoftFloat, StackAlignmentOverride and stack realignment are set by the
+  // target, see LLVM_SET_TARGET_MACHINE_OPTIONS and LLVM_SET_MACHINE_OPTIONS.
   // TODO: DisableTailCalls.
   // TODO: TrapFuncName.
   // TODO: -fsplit-stack
@@ -531,6 +701,9 @@ static void CreateTargetMachine(const std::string &TargetTriple) {
   // directory.  FIXME: Once GCC learns to detect support for this, condition
   // on what GCC detected.
   Options.MCOptions.MCUseDwarfDirectory = false;
+  // Compressing the debug sections is done by the object writer, so this only
+  // has an effect if the object file is produced by LLVM.
+  Options.CompressDebugSections = CompressDebugSections;
 
   TheTarget = TME->createTargetMachine(TargetTriple, CPU, FeatureStr, Options,
                                        RelocModel, CMModel, CodeGenOptLevel());
@@ -603,6 +776,11 @@ bool flag_odr;
 /// the arguments given in the function type.
 bool flag_functions_from_args;
 
+/// ComputedGotoUnfactorLimit - The maximum number of indirect branch
+/// destinations that may be added when giving each computed goto its own
+/// indirect branch.  Zero means computed gotos are never unfactored.
+unsigned ComputedGotoUnfactorLimit = 10000;
+
 /// InstallLanguageSettings - Do any language-specific back-end configuration.
 static void InstallLanguageSettings() {
   // The principal here is that not doing any language-specific configuration
@@ -669,6 +847,20 @@ static void InitializeBackend(void) {
   if (flag_no_simplify_libcalls)
     PassBuilder.LibraryInfo->disableAllFunctions();
 
+  // Read in the profiles, if any.
+  if (!EdgeProfileFile.empty()) {
+    std::string Error;
+    if (!LoadEdgeProfile(EdgeProfileFile.c_str(), Error))
+      warning(0, G_("cannot read profile '%s': %s"), EdgeProfileFile.c_str(),
+              Error.c_str());
+  }
+  if (ICallProfileUseFile) {
+    std::string Error;
+    if (!LoadIndirectCallProfile(ICallProfileUseFile, Error))
+      warning(0, G_("cannot read indirect call profile '%s': %s"),
+              ICallProfileUseFile, Error.c_str());
+  }
+
   Initialized = true;
 }
 
@@ -735,6 +927,31 @@ static void createPerFunctionOptimizationPasses() {
   PerFunctionPasses->doInitialization();
 }
 
+namespace {
+/// BuiltinConstantPFolder - Resolve calls to __builtin_constant_p whose argument
+/// has become constant.  This is run once inlining and constant propagation
+/// have been done, followed by passes that remove the code made dead.
+struct BuiltinConstantPFolder : public FunctionPass {
+  static char ID;
+  BuiltinConstantPFolder() : FunctionPass(ID) {}
+  const char *getPassName() const override {
+    return "Fold __builtin_constant_p";
+  }
+  bool runOnFunction(Function &F) override {
+    return FoldBuiltinConstantP(F, false);
+  }
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+  }
+};
+char BuiltinConstantPFolder::ID = 0;
+}
+
+static void addBuiltinConstantPFolder(const PassManagerBuilder &,
+                                      PassManagerBase &PM) {
+  PM.add(new BuiltinConstantPFolder());
+}
+
 static void createPerModuleOptimizationPasses() {
   if (PerModulePasses)
     return;
@@ -768,13 +985,25 @@ static void createPerModuleOptimizationPasses() {
 
   PassBuilder.OptLevel = ModuleOptLevel();
   PassBuilder.Inliner = InliningPass;
+  PassBuilder.addExtension(PassManagerBuilder::EP_ScalarOptimizerLate,
+                           addBuiltinConstantPFolder);
   PassBuilder.populateModulePassManager(*PerModulePasses);
 
+  // Fold functions with identical bodies, such as template instantiations that
+  // only differ in the types of pointers.  This is done after the other passes
+  // so that the bodies being compared are in their final form, and is done at
+  // every optimization level since it reduces the work for the code generator.
+  if (MergeFunctions)
+    PerModulePasses->add(createMergeFunctionsPass());
+
   if (EmitIR) {
     // Emit an LLVM .ll file to the output.  This is used when passed
-    // -emit-llvm -S to the GCC driver.
+    // -emit-llvm -S to the GCC driver.  The module is printed in place of
+    // running the code generator, so that it includes any changes made after
+    // the module-level optimizers have run.
     InitializeOutputStreams(false);
-    PerModulePasses->add(createPrintModulePass(*OutStream));
+    CodeGenPasses = new PassManager();
+    CodeGenPasses->add(createPrintModulePass(*OutStream));
   } else {
     // If there are passes we have to run on the entire module, we do codegen
     // as a separate "pass" after that happens.
@@ -1139,6 +1368,7 @@ static void emit_global(tree decl) {
   GV->setUnnamedAddr(flag_merge_constants >= 2 || !TREE_ADDRESSABLE(decl));
 
   handleVisibility(decl, GV);
+  handleLocalBinding(decl, GV);
 
   // Set the section for the global.
   if (isa<VAR_DECL>(decl)) {
@@ -1461,6 +1691,12 @@ Value *make_decl_llvm(tree decl) {
             DECL_INITIAL(decl) && (TREE_CONSTANT(DECL_INITIAL(decl)) ||
                                    isa<STRING_CST>(DECL_INITIAL(decl))))
           GV->setConstant(true);
+        // GCC's IPA passes mark variables that are never written readonly, and
+        // these may have no initializer, meaning that they are zero.  Common
+        // variables may not be constant though.
+        else if (isa<VAR_DECL>(decl) && !DECL_INITIAL(decl) &&
+                 !DECL_COMMON(decl))
+          GV->setConstant(true);
       }
     }
 
@@ -1540,6 +1776,12 @@ static void FinalizePlugin(void) {
   if (Finalized)
     return;
 
+#if (GCC_MINOR > 5)
+  // Output the time taken by GCC passes, if they were timed.
+  delete GCCPassTimers;
+  GCCPassTimers = 0;
+#endif
+
 #ifndef NDEBUG
   delete PerModulePasses;
   delete PerFunctionPasses;
@@ -1692,6 +1934,13 @@ static void emit_current_function() {
   emit_cgraph_aliases(cgraph_get_node(current_function_decl));
 
   if (!errorcount && !sorrycount) { // Do not process broken code.
+    // Use the profile to guide optimization and/or instrument the function to
+    // produce a new profile.  This needs to be done on the function exactly as
+    // converted, so that the profile matches the instrumentation.
+    ApplyEdgeProfile(Fn);
+    if (ProfileGenerate)
+      InstrumentEdges(Fn);
+
     createPerFunctionOptimizationPasses();
 
     if (PerFunctionPasses)
@@ -1722,6 +1971,18 @@ static unsigned int rtl_emit_function(void) {
   delete_tree_cfg_annotations();
 #endif
 
+  // Nothing looks at the gimple form of the function once it has been turned
+  // into LLVM IR, so release it now rather than when the call graph finally
+  // gets around to the function body.  This is what GCC's own expansion to RTL
+  // does, and it means the memory can be reused for the next function.
+  delete_tree_ssa();
+  set_eh_throw_stmt_table(cfun, NULL);
+  basic_block bb;
+  FOR_EACH_BB(bb) {
+    set_phi_nodes(bb, NULL);
+    set_bb_seq(bb, NULL);
+  }
+
   // Finally, we have written out this function!
   TREE_ASM_WRITTEN(current_function_decl) = 1;
   return 0;
@@ -1742,7 +2003,9 @@ static struct rtl_opt_pass pass_rtl_emit_function = { {
   PROP_ssa | PROP_gimple_leh | PROP_cfg, /* properties_required */
   0,                                     /* properties_provided */
   PROP_ssa | PROP_trees,                 /* properties_destroyed */
-  TODO_verify_ssa | TODO_verify_flow | TODO_verify_stmts
+  TODO_verify_ssa | TODO_verify_flow |
+  TODO_verify_stmts,                     /* todo_flags_start */
+  TODO_ggc_collect                       /* todo_flags_finish */
 } };
 
 /// emit_file_scope_asms - Output any file-scope assembly.
@@ -1885,6 +2148,10 @@ static void llvm_finish_unit(void */*gcc_data*/, void */*user_data*/) {
   if (!quiet_flag)
     errs() << "Finishing compilation unit\n";
 
+#if (GCC_MINOR > 5)
+  StopGCCPassTimer();
+#endif
+
   InitializeBackend();
   if (TheDebugInfo) {
     delete TheDebugInfo;
@@ -1904,6 +2171,10 @@ static void llvm_finish_unit(void */*gcc_data*/, void */*user_data*/) {
   //TODO        I->addFnAttr(Attribute::NoImplicitFloat);
   //TODO    }
 
+  // Arrange for any indirect call profile to be written out on exit.
+  if (Function *ProfileWriter = FinishIndirectCallProfile())
+    register_ctor_dtor(ProfileWriter, DEFAULT_INIT_PRIORITY, false);
+
   // Add an llvm.global_ctors global if needed.
   if (!StaticCtors.empty())
     CreateStructorsList(StaticCtors, "llvm.global_ctors");
@@ -1968,11 +2239,23 @@ static void llvm_finish_unit(void */*gcc_data*/, void */*user_data*/) {
   if (PerFunctionPasses)
     PerFunctionPasses->doFinalization();
 
+  // Turn any profiling instrumentation into counters.
+  FinishEdgeProfile();
+
   // Run module-level optimizers, if any are present.
   createPerModuleOptimizationPasses();
   if (PerModulePasses)
     PerModulePasses->run(*TheModule);
 
+  // Any calls to __builtin_constant_p that the optimizers did not resolve are
+  // for values that are not constant.
+  FinishBuiltinConstantP(*TheModule);
+
+  // Only now bypass the GOT and PLT, since the optimizers would be hindered by
+  // the aliases.
+  if (flag_pic)
+    BindLocally();
+
   // Run the code generator, if present.
   if (CodeGenPasses) {
     // Arrange for inline asm problems to be printed nicely.
@@ -2123,9 +2406,128 @@ static struct simple_ipa_opt_pass pass_simple_ipa_null = { {
   0                                    /* todo_flags_finish */
 } };
 
+/// TurnOffGCCPass - Replace the GCC pass with the given name by a pass that does
+/// nothing, unless the user asked for it to be run.
+static void TurnOffGCCPass(const char *plugin_name, struct opt_pass *null_pass,
+                           const char *name) {
+  if (SelectGCCPasses) {
+    if (KeptGCCPasses.count(name))
+      return;
+    // Keep the optimization pipelines; the passes they contain are filtered
+    // individually by override_gcc_gate.
+    if (!strcmp(name, "early_optimizations") ||
+        !strcmp(name, "*all_optimizations"))
+      return;
+  }
+
+  struct register_pass_info pass_info;
+  pass_info.pass = null_pass;
+  pass_info.reference_pass_name = name;
+  pass_info.ref_pass_instance_number = 0;
+  pass_info.pos_op = PASS_POS_REPLACE;
+  register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+}
+
+/// FilteredGCCPasses - Passes in the GCC optimization pipelines which are only
+/// run if the user asked for them.
+static SmallPtrSet<struct opt_pass *, 128> FilteredGCCPasses;
+
+/// isRequiredGCCPass - Whether the pass sets up or tears down state that other
+/// passes depend on, and so must run whichever passes the user selected.  This
+/// covers the internal passes (whose names start with '*') and the passes that
+/// create and free the loop structures used by the loop optimizers.
+static bool isRequiredGCCPass(struct opt_pass *pass) {
+  const char *name = pass->name;
+  return !name || name[0] == '*' || !strcmp(name, "loopinit") ||
+         !strcmp(name, "loopdone");
+}
+
+/// AddFilteredGCCPasses - Add the given passes, and any passes they contain,
+/// to FilteredGCCPasses.  Passes that only exist to hold other passes are run
+/// so that the passes they contain can be selected individually.
+static void AddFilteredGCCPasses(struct opt_pass *pass) {
+  for (; pass; pass = pass->next)
+    if (pass->sub)
+      AddFilteredGCCPasses(pass->sub);
+    else if (!isRequiredGCCPass(pass))
+      FilteredGCCPasses.insert(pass);
+}
+
+/// override_gcc_gate - Called when GCC decides whether to run a pass.  Stops
+/// any optimization passes the user did not ask for from being run.
+static void override_gcc_gate(void *gcc_data, void */*user_data*/) {
+#if (GCC_MINOR > 5)
+  // The previous pass, including any cleanups it asked for, is now done.
+  StopGCCPassTimer();
+#endif
+  bool *gate_status = (bool *)gcc_data;
+  if (!*gate_status || !current_pass || !current_pass->name)
+    return;
+  const char *name = current_pass->name;
+  if (!strcmp(name, "early_optimizations") ||
+      !strcmp(name, "*all_optimizations")) {
+    AddFilteredGCCPasses(current_pass->sub);
+    return;
+  }
+  if (FilteredGCCPasses.count(current_pass) && !KeptGCCPasses.count(name))
+    *gate_status = false;
+}
+
+#if (GCC_MINOR > 5)
+/// time_gcc_pass - Called when GCC runs a pass.  If the user selected the pass
+/// then it is charged with the time until GCC decides whether to run the next
+/// pass, which override_gcc_gate uses to stop the timer.
+static void time_gcc_pass(void *gcc_data, void */*user_data*/) {
+  StopGCCPassTimer();
+  struct opt_pass *pass = (struct opt_pass *)gcc_data;
+  if (!pass->name || !KeptGCCPasses.count(pass->name))
+    return;
+  if (!GCCPassTimers)
+    GCCPassTimers = new TimerGroup("GCC passes run before conversion");
+  Timer *&T = GCCPassTimerMap[pass->name];
+  if (!T)
+    T = new Timer(pass->name, *GCCPassTimers);
+  RunningGCCPassTimer = T;
+  T->startTimer();
+}
+#endif
+
 // Garbage collector roots.
 extern const struct ggc_cache_tab gt_ggc_rc__gt_cache_h[];
 
+/// TakeoverProfiling - Arrange for -fprofile-arcs, -fprofile-generate and
+/// -fprofile-use to be handled by LLVM.  GCC's own profiling is turned off: its
+/// instrumentation would be lost anyway when the GCC optimizers are disabled,
+/// and the LLVM profiles can be merged using the standard LLVM tools.
+static void TakeoverProfiling() {
+  std::string Dir = profile_data_prefix ? profile_data_prefix : ".";
+
+  if (profile_arc_flag) {
+    // The edge profile is written by the LLVM profile runtime, which names the
+    // file after the LLVM_PROFILE_FILE environment variable.
+    ProfileGenerate = true;
+    if (flag_profile_values && !ICallProfileGenerateFile)
+      ICallProfileGenerateFile = xstrdup((Dir + "/default.icallprof").c_str());
+    profile_arc_flag = 0;
+  }
+
+  if (flag_branch_probabilities) {
+    // -fprofile-use=path may name the profile itself rather than a directory.
+    if (sys::fs::is_regular_file(Dir)) {
+      EdgeProfileFile = Dir;
+    } else {
+      EdgeProfileFile = Dir + "/default.profdata";
+      std::string ICallFile = Dir + "/default.icallprof";
+      if (flag_profile_values && !ICallProfileUseFile &&
+          sys::fs::exists(ICallFile))
+        ICallProfileUseFile = xstrdup(ICallFile.c_str());
+    }
+    flag_branch_probabilities = 0;
+  }
+
+  flag_profile_values = 0;
+}
+
 /// PluginFlags - Flag arguments for the plugin.
 
 struct FlagDescriptor {
@@ -2134,10 +2536,14 @@ struct FlagDescriptor {
 };
 
 static FlagDescriptor PluginFlags[] = {
+  { "compress-debug-sections", &CompressDebugSections },
   { "debug-pass-structure", &DebugPassStructure },
   { "debug-pass-arguments", &DebugPassArguments },
   { "enable-gcc-optzns", &EnableGCCOptimizations }, { "emit-ir", &EmitIR },
-  { "emit-obj", &EmitObj },
+  { "emit-obj", &EmitObj }, { "merge-functions", &MergeFunctions },
+  { "no-plt", &NoPLT },
+  { "no-semantic-interposition", &NoSemanticInterposition },
+  { "profile-atomic-counters", &ProfileAtomicCounters },
   { "save-gcc-output", &SaveGCCOutput }, { NULL, NULL } // Terminator.
 };
 
@@ -2208,6 +2614,48 @@ int __attribute__((visibility("default"))) plugin_init(
         continue;
       }
 
+      if (!strcmp(argv[i].key, "computed-goto-limit")) {
+        if (!argv[i].value) {
+          error(G_("no value supplied for option '-fplugin-arg-%s-%s'"),
+                plugin_name, argv[i].key);
+          continue;
+        }
+        if (StringRef(argv[i].value).getAsInteger(10,
+                                                  ComputedGotoUnfactorLimit))
+          error(G_("invalid option argument '-fplugin-arg-%s-%s=%s'"),
+                plugin_name, argv[i].key, argv[i].value);
+        continue;
+      }
+
+      if (!strcmp(argv[i].key, "gcc-passes")) {
+        if (!argv[i].value) {
+          error(G_("no value supplied for option '-fplugin-arg-%s-%s'"),
+                plugin_name, argv[i].key);
+          continue;
+        }
+        // A comma separated list of GCC pass names, as used in dump files.
+        SelectGCCPasses = true;
+        SmallVector<StringRef, 16> Names;
+        StringRef(argv[i].value).split(Names, ",", -1, false);
+        for (unsigned j = 0, e = Names.size(); j != e; ++j)
+          KeptGCCPasses.insert(Names[j]);
+        continue;
+      }
+
+      if (!strcmp(argv[i].key, "profile-icall-generate") ||
+          !strcmp(argv[i].key, "profile-icall-use")) {
+        if (!argv[i].value) {
+          error(G_("no value supplied for option '-fplugin-arg-%s-%s'"),
+                plugin_name, argv[i].key);
+          continue;
+        }
+        if (argv[i].key[14] == 'g')
+          ICallProfileGenerateFile = argv[i].value;
+        else
+          ICallProfileUseFile = argv[i].value;
+        continue;
+      }
+
       if (!strcmp(argv[i].key, "llvm-option")) {
         if (!argv[i].value) {
           error(G_("no value supplied for option '-fplugin-arg-%s-%s'"),
@@ -2265,6 +2713,9 @@ int __attribute__((visibility("default"))) plugin_init(
     }
   }
 
+  // Profile using LLVM rather than GCC.
+  TakeoverProfiling();
+
   // Obtain exclusive use of the assembly code output file.  This stops GCC from
   // writing anything at all to the assembly file - only we get to write to it.
   TakeoverAsmOutput();
@@ -2276,6 +2727,17 @@ int __attribute__((visibility("default"))) plugin_init(
   // Perform late initialization just before processing the compilation unit.
   register_callback(plugin_name, PLUGIN_START_UNIT, llvm_start_unit, NULL);
 
+  // Only run the GCC optimization passes the user asked for, if any.
+  if (SelectGCCPasses && !EnableGCCOptimizations) {
+    register_callback(plugin_name, PLUGIN_OVERRIDE_GATE, override_gcc_gate,
+                      NULL);
+#if (GCC_MINOR > 5)
+    if (time_report)
+      register_callback(plugin_name, PLUGIN_PASS_EXECUTION, time_gcc_pass,
+                        NULL);
+#endif
+  }
+
   // Turn off all gcc optimization passes.
   if (!EnableGCCOptimizations) {
 // TODO: figure out a good way of turning off ipa optimization passes.
@@ -2288,11 +2750,7 @@ int __attribute__((visibility("default"))) plugin_init(
 
 #if (GCC_MINOR < 6)
     // Turn off pass_ipa_early_inline.
-    pass_info.pass = &pass_simple_ipa_null.pass;
-    pass_info.reference_pass_name = "einline_ipa";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_simple_ipa_null.pass, "einline_ipa");
 #endif
 
     // Leave pass pass_early_local_passes::pass_fixup_cfg. ???
@@ -2306,11 +2764,7 @@ int __attribute__((visibility("default"))) plugin_init(
     // Leave pass_early_local_passes::pass_build_ssa.
 
     // Turn off pass_lower_vector.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "veclower";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "veclower");
 
     // Leave pass_early_local_passes::pass_early_warn_uninitialized.
 
@@ -2332,11 +2786,7 @@ int __attribute__((visibility("default"))) plugin_init(
     register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
 
     // Turn off pass_early_local_passes::pass_all_early_optimizations.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "early_optimizations";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "early_optimizations");
 
     // Leave pass_early_local_passes::pass_release_ssa_names. ???
 
@@ -2348,19 +2798,12 @@ int __attribute__((visibility("default"))) plugin_init(
     // Leave pass pass_early_local_passes::pass_tree_profile.
 
     // Turn off pass_ipa_increase_alignment.
-    pass_info.pass = &pass_simple_ipa_null.pass;
-    pass_info.reference_pass_name = "increase_alignment";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_simple_ipa_null.pass,
+                   "increase_alignment");
 
 #if (GCC_MINOR < 8)
     // Turn off pass_ipa_matrix_reorg.
-    pass_info.pass = &pass_simple_ipa_null.pass;
-    pass_info.reference_pass_name = "matrix-reorg";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_simple_ipa_null.pass, "matrix-reorg");
 #endif
 
     // Leave pass_ipa_tm.
@@ -2372,58 +2815,30 @@ int __attribute__((visibility("default"))) plugin_init(
     // Leave pass_ipa_profile. ???
 
     // Turn off pass_ipa_cp.
-    pass_info.pass = &pass_ipa_null.pass;
-    pass_info.reference_pass_name = "cp";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_ipa_null.pass, "cp");
 
     // Leave pass_ipa_cdtor_merge.
 
     // Turn off pass_ipa_inline.
-    pass_info.pass = &pass_ipa_null.pass;
-    pass_info.reference_pass_name = "inline";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_ipa_null.pass, "inline");
 
     // Turn off pass_ipa_pure_const.
-    pass_info.pass = &pass_ipa_null.pass;
-    pass_info.reference_pass_name = "pure-const";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_ipa_null.pass, "pure-const");
 
     // Turn off pass_ipa_reference.
-    pass_info.pass = &pass_ipa_null.pass;
-    pass_info.reference_pass_name = "static-var";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_ipa_null.pass, "static-var");
 
 #if (GCC_MINOR < 7)
     // Turn off pass_ipa_type_escape.
-    pass_info.pass = &pass_simple_ipa_null.pass;
-    pass_info.reference_pass_name = "type-escape-var";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_simple_ipa_null.pass, "type-escape-var");
 #endif
 
     // Turn off pass_ipa_pta.
-    pass_info.pass = &pass_simple_ipa_null.pass;
-    pass_info.reference_pass_name = "pta";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_simple_ipa_null.pass, "pta");
 
 #if (GCC_MINOR < 7)
     // Turn off pass_ipa_struct_reorg.
-    pass_info.pass = &pass_simple_ipa_null.pass;
-    pass_info.reference_pass_name = "ipa_struct_reorg";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_simple_ipa_null.pass, "ipa_struct_reorg");
 #endif
   }
 
@@ -2457,62 +2872,30 @@ int __attribute__((visibility("default"))) plugin_init(
 
   if (!EnableGCCOptimizations) {
     // Disable pass_lower_eh_dispatch.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "ehdisp";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "ehdisp");
 
     // Disable pass_all_optimizations.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "*all_optimizations";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "*all_optimizations");
 
     // Leave pass_tm_init.
 
     // Disable pass_lower_complex_O0.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "cplxlower0";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "cplxlower0");
 
     // Disable pass_cleanup_eh.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "ehcleanup";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "ehcleanup");
 
     // Disable pass_lower_resx.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "resx";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "resx");
 
     // Disable pass_nrv.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "nrv";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "nrv");
 
     // Disable pass_mudflap_2. ???
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "mudflap2";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "mudflap2");
 
     // Disable pass_cleanup_cfg_post_optimizing.
-    pass_info.pass = &pass_gimple_null.pass;
-    pass_info.reference_pass_name = "optimized";
-    pass_info.ref_pass_instance_number = 0;
-    pass_info.pos_op = PASS_POS_REPLACE;
-    register_callback(plugin_name, PLUGIN_PASS_MANAGER_SETUP, NULL, &pass_info);
+    TurnOffGCCPass(plugin_name, &pass_gimple_null.pass, "optimized");
 
     // TODO: Disable pass_warn_function_noreturn?
   }
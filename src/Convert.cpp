@@ -25,17 +25,23 @@
 #include "dragonegg/Aliasing.h"
 #include "dragonegg/ConstantConversion.h"
 #include "dragonegg/Debug.h"
+#include "dragonegg/Profile.h"
 #include "dragonegg/TypeConversion.h"
 
 // LLVM headers
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/Analysis/InstructionSimplify.h"
 #include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Target/TargetLowering.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
 
 // System headers
 #include <gmp.h>
@@ -102,6 +108,9 @@ static LLVMContext &Context = getGlobalContext();
 #define DEBUG_TYPE "dragonegg"
 STATISTIC(NumBasicBlocks, "Number of basic blocks converted");
 STATISTIC(NumStatements, "Number of gimple statements converted");
+STATISTIC(NumIdiomsRecognized, "Number of bit manipulation idioms recognized");
+STATISTIC(NumScalarizedLocals, "Number of local aggregates held in registers");
+STATISTIC(NumUnfactoredGotos, "Number of computed goto dispatches unfactored");
 
 /// getPointerAlignment - Return the alignment in bytes of exp, a pointer valued
 /// expression, or 1 if the alignment is not known.
@@ -897,6 +906,37 @@ static bool isPassedByVal(tree type, Type *Ty, std::vector<Type *> &ScalarArgs,
   return false;
 }
 
+/// FindModifiedParameters - Collect the parameters of the current function that
+/// are stored to, in whole or in part, by its body.
+static void FindModifiedParameters(SmallPtrSet<tree, 4> &Modified) {
+  basic_block bb;
+  FOR_EACH_BB(bb) {
+    for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+         gsi_next(&gsi)) {
+      gimple stmt = gsi_stmt(gsi);
+      if (is_gimple_debug(stmt))
+        continue;
+
+      if (gimple_code(stmt) == GIMPLE_ASM) {
+        for (unsigned i = 0, e = gimple_asm_noutputs(stmt); i != e; ++i) {
+          tree op = TREE_VALUE(gimple_asm_output_op(stmt, i));
+          tree base = get_base_address(op);
+          if (base && isa<PARM_DECL>(base))
+            Modified.insert(base);
+        }
+        continue;
+      }
+
+      tree lhs = gimple_get_lhs(stmt);
+      if (!lhs)
+        continue;
+      tree base = get_base_address(lhs);
+      if (base && isa<PARM_DECL>(base))
+        Modified.insert(base);
+    }
+  }
+}
+
 void TreeToLLVM::StartFunctionBody() {
   // TODO: Add support for dropping the leading '\1' in order to support
   //   unsigned bswap(unsigned) __asm__("llvm.bswap");
@@ -935,6 +975,9 @@ void TreeToLLVM::StartFunctionBody() {
     // The visibility can be changed from the last time we've seen this
     // function. Set to current.
     handleVisibility(FnDecl, Fn);
+    // So can the attributes, since GCC's (IPA) pure-const pass may have run on
+    // the function since the prototype was made.
+    Fn->setAttributes(PAL);
   } else {
     std::string Name = getAssemblerName(FnDecl);
     Function *FnEntry = TheModule->getFunction(Name);
@@ -993,6 +1036,7 @@ void TreeToLLVM::StartFunctionBody() {
 
   // Handle visibility style
   handleVisibility(FnDecl, Fn);
+  handleLocalBinding(FnDecl, Fn);
 
   // Register constructors and destructors.
   if (DECL_STATIC_CONSTRUCTOR(FnDecl))
@@ -1024,7 +1068,8 @@ void TreeToLLVM::StartFunctionBody() {
   if (DECL_DECLARED_INLINE_P(FnDecl))
     Fn->addFnAttr(Attribute::InlineHint);
 
-  if (optimize_size)
+  // This takes the cold attribute into account.
+  if (optimize_function_for_size_p(cfun))
     Fn->addFnAttr(Attribute::OptimizeForSize);
 
   // Handle stack smashing protection.
@@ -1051,6 +1096,19 @@ void TreeToLLVM::StartFunctionBody() {
     Fn->addFnAttr("no-frame-pointer-elim-non-leaf", "true");
   }
 
+  // Handle floating point options.  These can be changed for an individual
+  // function using the optimize attribute, so record them on the function.
+  Fn->addFnAttr("less-precise-fpmad",
+                flag_unsafe_math_optimizations ? "true" : "false");
+  Fn->addFnAttr("no-infs-fp-math", flag_finite_math_only ? "true" : "false");
+  Fn->addFnAttr("no-nans-fp-math", flag_finite_math_only ? "true" : "false");
+#if (GCC_MINOR > 5)
+  bool UnsafeFPMath = fast_math_flags_set_p(&global_options);
+#else
+  bool UnsafeFPMath = fast_math_flags_set_p();
+#endif
+  Fn->addFnAttr("unsafe-fp-math", UnsafeFPMath ? "true" : "false");
+
 #ifdef LLVM_SET_TARGET_MACHINE_ATTRIBUTES
   LLVM_SET_TARGET_MACHINE_ATTRIBUTES(Fn);
 #endif
@@ -1068,7 +1126,8 @@ void TreeToLLVM::StartFunctionBody() {
 
   // Create a new basic block for the function.
   BasicBlock *EntryBlock = BasicBlock::Create(Context, "entry", Fn);
-  BasicBlocks[ENTRY_BLOCK_PTR] = EntryBlock;
+  BasicBlocks.assign(last_basic_block, 0);
+  BasicBlocks[ENTRY_BLOCK_PTR->index] = EntryBlock;
   Builder.SetInsertPoint(EntryBlock);
 
   if (EmitDebugInfo())
@@ -1092,6 +1151,10 @@ void TreeToLLVM::StartFunctionBody() {
   // Prepend the static chain (if any) to the list of arguments.
   tree Args = static_chain ? static_chain : DECL_ARGUMENTS(FnDecl);
 
+  // Parameters that the function body stores to.
+  SmallPtrSet<tree, 4> ModifiedParms;
+  FindModifiedParameters(ModifiedParms);
+
   // Scalar arguments processed so far.
   std::vector<Type *> ScalarArgs;
   while (Args) {
@@ -1116,6 +1179,13 @@ void TreeToLLVM::StartFunctionBody() {
       // double and large x86-64 vectors), we need to make the copy.
       AI->setName(Name);
       SET_DECL_LOCAL(Args, AI);
+      // If the body never writes to the argument and its address does not
+      // escape then the memory pointed to is only ever read, in place.
+      if (!TREE_ADDRESSABLE(Args) && !ModifiedParms.count(Args)) {
+        AttrBuilder B;
+        B.addAttribute(Attribute::ReadOnly).addAttribute(Attribute::NoCapture);
+        AI->addAttr(AttributeSet::get(Context, AI->getArgNo() + 1, B));
+      }
       if (!isInvRef && EmitDebugInfo())
         TheDebugInfo->EmitDeclare(Args, dwarf::DW_TAG_arg_variable, Name,
                                   TREE_TYPE(Args), AI, Builder);
@@ -1226,14 +1296,14 @@ void TreeToLLVM::PopulatePhiNodes() {
       basic_block bb = gimple_phi_arg_edge(P.gcc_phi, i)->src;
 
       // The corresponding LLVM basic block.
-      DenseMap<basic_block, BasicBlock *>::iterator BI = BasicBlocks.find(bb);
-      assert(BI != BasicBlocks.end() && "GCC basic block not output?");
+      assert((unsigned) bb->index < BasicBlocks.size() &&
+             BasicBlocks[bb->index] && "GCC basic block not output?");
 
       // The incoming GCC expression.
       tree val = gimple_phi_arg(P.gcc_phi, i)->def;
 
       // Associate it with the LLVM basic block.
-      IncomingValues.push_back(std::make_pair(BI->second, val));
+      IncomingValues.push_back(std::make_pair(BasicBlocks[bb->index], val));
 
       // Several LLVM basic blocks may be generated when emitting one GCC basic
       // block.  The additional blocks always occur immediately after the main
@@ -1321,6 +1391,134 @@ void TreeToLLVM::PopulatePhiNodes() {
   PendingPhis.clear();
 }
 
+/// UnfactorComputedGoto - GCC funnels all of the computed gotos in a function
+/// through a single block holding one indirect branch.  If BB is such a block
+/// then give each block that branches to it a copy of the indirect branch, so
+/// that each computed goto can be predicted separately.  Returns whether BB was
+/// unfactored.
+static bool UnfactorComputedGoto(BasicBlock *BB) {
+  IndirectBrInst *IBr = dyn_cast<IndirectBrInst>(BB->getTerminator());
+  if (!IBr || BB->getFirstNonPHI() != IBr || BB->hasAddressTaken())
+    return false;
+
+  // Only blocks that branch unconditionally to BB get a copy of the branch.
+  SmallVector<BasicBlock *, 32> Preds;
+  bool KeepBB = false;
+  for (pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE; ++PI) {
+    BranchInst *Br = dyn_cast<BranchInst>((*PI)->getTerminator());
+    if (Br && Br->isUnconditional())
+      Preds.push_back(*PI);
+    else
+      KeepBB = true;
+  }
+  if (Preds.size() < 2)
+    return false;
+
+  // Check that the copies would not be too big.
+  unsigned NumDests = IBr->getNumDestinations();
+  if ((uint64_t) Preds.size() * NumDests > ComputedGotoUnfactorLimit)
+    return false;
+
+  SmallPtrSet<BasicBlock *, 32> Seen;
+  SmallVector<BasicBlock *, 32> Dests;
+  for (unsigned i = 0; i != NumDests; ++i)
+    if (Seen.insert(IBr->getDestination(i)).second)
+      Dests.push_back(IBr->getDestination(i));
+  if (Seen.count(BB))
+    return false;
+
+  // Remember the values the phi nodes in BB take when coming from each of the
+  // predecessors.  A value that is the phi node itself is not changed by the
+  // predecessor.  Give up if a phi node takes the value of a different one.
+  SmallVector<PHINode *, 16> Phis;
+  SmallVector<SmallVector<Value *, 32>, 16> PhiValues;
+  for (BasicBlock::iterator II = BB->begin();
+       PHINode *PN = dyn_cast<PHINode>(II); ++II) {
+    Phis.push_back(PN);
+    PhiValues.push_back(SmallVector<Value *, 32>());
+    for (unsigned i = 0, e = Preds.size(); i != e; ++i) {
+      Value *V = PN->getIncomingValueForBlock(Preds[i]);
+      PHINode *VPN = dyn_cast<PHINode>(V);
+      if (VPN && VPN != PN && VPN->getParent() == BB)
+        return false;
+      PhiValues.back().push_back(V);
+    }
+  }
+
+  // The address branched to is usually one of the phi nodes in BB.  Each copy
+  // of the branch needs to jump to the address its predecessor passes in.
+  int AddrPhi = -1;
+  for (unsigned p = 0, pe = Phis.size(); p != pe; ++p)
+    if (Phis[p] == IBr->getAddress())
+      AddrPhi = p;
+
+  // Replace the branch to BB in each predecessor with an indirect branch, and
+  // have the destinations receive the same values as if the predecessor had
+  // gone via BB.  Any other uses of the phi nodes in BB are fixed up below.
+  for (unsigned i = 0, e = Preds.size(); i != e; ++i) {
+    TerminatorInst *Br = Preds[i]->getTerminator();
+    Value *Addr = IBr->getAddress();
+    if (AddrPhi >= 0)
+      Addr = PhiValues[AddrPhi][i];
+    IndirectBrInst *Copy = IndirectBrInst::Create(Addr, NumDests, Br);
+    for (unsigned j = 0; j != NumDests; ++j)
+      Copy->addDestination(IBr->getDestination(j));
+    Br->eraseFromParent();
+    BB->removePredecessor(Preds[i], /*DontDeleteUselessPHIs*/ true);
+  }
+  for (unsigned i = 0, e = Dests.size(); i != e; ++i) {
+    for (BasicBlock::iterator II = Dests[i]->begin();
+         PHINode *PN = dyn_cast<PHINode>(II); ++II) {
+      Value *V = PN->getIncomingValueForBlock(BB);
+      for (unsigned j = 0, je = Preds.size(); j != je; ++j)
+        PN->addIncoming(V, Preds[j]);
+    }
+    if (!KeepBB)
+      Dests[i]->removePredecessor(BB, /*DontDeleteUselessPHIs*/ true);
+  }
+
+  // Values defined by phi nodes in BB may be used in the blocks it branches
+  // to.  These uses now need to see the value from whichever predecessor was
+  // executed last, so rewrite them to use new phi nodes.
+  for (unsigned p = 0, pe = Phis.size(); p != pe; ++p) {
+    PHINode *PN = Phis[p];
+    SmallVector<Use *, 16> Uses;
+    for (Value::use_iterator UI = PN->use_begin(), UE = PN->use_end();
+         UI != UE; ++UI) {
+      Instruction *User = cast<Instruction>(UI->getUser());
+      if (User->getParent() == BB)
+        continue;
+      // Phi nodes reached directly from BB are still correct.
+      PHINode *UserPN = dyn_cast<PHINode>(User);
+      if (UserPN && UserPN->getIncomingBlock(*UI) == BB)
+        continue;
+      Uses.push_back(&*UI);
+    }
+    if (Uses.empty())
+      continue;
+
+    SSAUpdater Updater;
+    Updater.Initialize(PN->getType(), PN->getName());
+    if (KeepBB)
+      Updater.AddAvailableValue(BB, PN);
+    for (unsigned i = 0, e = Preds.size(); i != e; ++i)
+      if (PhiValues[p][i] != PN)
+        Updater.AddAvailableValue(Preds[i], PhiValues[p][i]);
+    for (unsigned i = 0, e = Uses.size(); i != e; ++i)
+      Updater.RewriteUse(*Uses[i]);
+  }
+
+  // If nothing branches to BB any more then delete it.
+  if (!KeepBB) {
+    IBr->eraseFromParent();
+    for (unsigned p = 0, pe = Phis.size(); p != pe; ++p)
+      Phis[p]->eraseFromParent();
+    BB->eraseFromParent();
+  }
+
+  return true;
+}
+
 Function *TreeToLLVM::FinishFunctionBody() {
   if (ReturnBB) {
     // Insert the return block at the end of the function.
@@ -1477,15 +1675,38 @@ Function *TreeToLLVM::FinishFunctionBody() {
       }
     }
 
+  // Every GCC basic block was output, but some may no longer be branched to,
+  // for example a call to __builtin_unreachable guarded by a condition that
+  // was turned into an assumption.  Delete them.
+  for (Function::iterator I = std::next(Fn->begin()), E = Fn->end(); I != E;) {
+    BasicBlock *BB = I++; // Advance first, BB may be deleted.
+    if (pred_begin(BB) == pred_end(BB) && !BB->hasAddressTaken())
+      DeleteDeadBlock(BB);
+  }
+
+  // Now that all uses have been output, move the fields of scalarized local
+  // aggregates into registers.
+  PromoteScalarizedLocals();
+
+  // Give each computed goto its own indirect branch, like GCC does when it is
+  // optimizing for speed.
+  if (flag_expensive_optimizations && optimize_function_for_speed_p(cfun))
+    for (Function::iterator I = Fn->begin(), E = Fn->end(); I != E;) {
+      BasicBlock *BB = I++; // Advance first, BB may be deleted.
+      if (UnfactorComputedGoto(BB))
+        ++NumUnfactoredGotos;
+    }
+
   return Fn;
 }
 
 /// getBasicBlock - Find or create the LLVM basic block corresponding to BB.
 BasicBlock *TreeToLLVM::getBasicBlock(basic_block bb) {
   // If we already associated an LLVM basic block with BB, then return it.
-  DenseMap<basic_block, BasicBlock *>::iterator I = BasicBlocks.find(bb);
-  if (I != BasicBlocks.end())
-    return I->second;
+  if ((unsigned) bb->index >= BasicBlocks.size())
+    BasicBlocks.resize(bb->index + 1);
+  else if (BasicBlocks[bb->index])
+    return BasicBlocks[bb->index];
 
   // Otherwise, create a new LLVM basic block.
   BasicBlock *BB = BasicBlock::Create(Context);
@@ -1515,15 +1736,17 @@ BasicBlock *TreeToLLVM::getBasicBlock(basic_block bb) {
     BB->setName(Index);
   }
 
-  return BasicBlocks[bb] = BB;
+  return BasicBlocks[bb->index] = BB;
 }
 
 /// getLabelDeclBlock - Lazily get and create a basic block for the specified
 /// label.
 BasicBlock *TreeToLLVM::getLabelDeclBlock(tree LabelDecl) {
   assert(isa<LABEL_DECL>(LabelDecl) && "Isn't a label!?");
-  if (DECL_LOCAL_SET_P(LabelDecl))
-    return cast<BasicBlock>(DECL_LOCAL(LabelDecl));
+  // Labels in the function body are numbered densely by LABEL_DECL_UID.
+  int UID = LABEL_DECL_UID(LabelDecl);
+  if (UID >= 0 && (unsigned) UID < LabelBlocks.size() && LabelBlocks[UID])
+    return LabelBlocks[UID];
 
   basic_block bb = label_to_block(LabelDecl);
   if (!bb) {
@@ -1532,7 +1755,11 @@ BasicBlock *TreeToLLVM::getLabelDeclBlock(tree LabelDecl) {
   }
 
   BasicBlock *BB = getBasicBlock(bb);
-  SET_DECL_LOCAL(LabelDecl, BB);
+  if (UID >= 0) {
+    if ((unsigned) UID >= LabelBlocks.size())
+      LabelBlocks.resize(UID + 1);
+    LabelBlocks[UID] = BB;
+  }
   return BB;
 }
 
@@ -1676,6 +1903,9 @@ Function *TreeToLLVM::EmitFunction() {
   // Set up parameters and prepare for return, for the function.
   StartFunctionBody();
 
+  // Decide which local aggregates can live in registers.
+  FindScalarizableLocals();
+
   // Output the basic blocks.
   basic_block bb;
   FOR_EACH_BB(bb) EmitBasicBlock(bb);
@@ -2049,12 +2279,13 @@ static unsigned CostOfAccessingAllElements(tree type) {
       // there is a size zero field that is not represented in the LLVM type.
       if (integer_zerop(DECL_SIZE(Field)))
         continue;
+      FieldLayout Layout = GetFieldLayout(Field, Ty);
       // Bitfields are too hard - give up.
-      if (isBitfield(Field))
+      if (Layout.Bitfield)
         return TooCostly;
       // If there is no corresponding LLVM field then something funky is going
       // on - just give up.
-      if (GetFieldIndex(Field, Ty) == INT_MAX)
+      if (Layout.Index == INT_MAX)
         return TooCostly;
       TotalCost += CostOfAccessingAllElements(TREE_TYPE(Field));
       if (TotalCost >= TooCostly)
@@ -2108,7 +2339,8 @@ void TreeToLLVM::CopyElementByElement(MemRef DestLoc, MemRef SrcLoc,
       if (integer_zerop(DECL_SIZE(Field)))
         continue;
       // Get the address of the field.
-      int FieldIdx = GetFieldIndex(Field, Ty);
+      FieldLayout Layout = GetFieldLayout(Field, Ty);
+      int FieldIdx = Layout.Index;
       assert(FieldIdx != INT_MAX && "Should not be copying if no LLVM field!");
       Value *DestFieldPtr = Builder.CreateStructGEP(
           DestLoc.Ptr, FieldIdx, flag_verbose_asm ? "df" : "");
@@ -2119,8 +2351,8 @@ void TreeToLLVM::CopyElementByElement(MemRef DestLoc, MemRef SrcLoc,
       unsigned DestFieldAlign = DestLoc.getAlignment();
       unsigned SrcFieldAlign = SrcLoc.getAlignment();
       if (FieldIdx) {
-        DestFieldAlign = MinAlign(DestFieldAlign, getFieldAlignment(Field));
-        SrcFieldAlign = MinAlign(SrcFieldAlign, getFieldAlignment(Field));
+        DestFieldAlign = MinAlign(DestFieldAlign, Layout.Alignment);
+        SrcFieldAlign = MinAlign(SrcFieldAlign, Layout.Alignment);
       }
 
       // Copy the field.
@@ -2211,7 +2443,8 @@ void TreeToLLVM::ZeroElementByElement(MemRef DestLoc, tree type) {
       if (integer_zerop(DECL_SIZE(Field)))
         continue;
       // Get the address of the field.
-      int FieldIdx = GetFieldIndex(Field, Ty);
+      FieldLayout Layout = GetFieldLayout(Field, Ty);
+      int FieldIdx = Layout.Index;
       assert(FieldIdx != INT_MAX && "Should not be zeroing if no LLVM field!");
       Value *FieldPtr = Builder.CreateStructGEP(DestLoc.Ptr, FieldIdx,
                                                 flag_verbose_asm ? "zf" : "");
@@ -2219,7 +2452,7 @@ void TreeToLLVM::ZeroElementByElement(MemRef DestLoc, tree type) {
       // Compute the field's alignment.
       unsigned FieldAlign = DestLoc.getAlignment();
       if (FieldIdx)
-        FieldAlign = MinAlign(FieldAlign, getFieldAlignment(Field));
+        FieldAlign = MinAlign(FieldAlign, Layout.Alignment);
 
       // Zero the field.
       MemRef FieldLoc(FieldPtr, FieldAlign, DestLoc.Volatile);
@@ -2461,6 +2694,228 @@ void TreeToLLVM::EmitAutomaticVariableDecl(tree decl) {
   }
 }
 
+//===----------------------------------------------------------------------===//
+//                    ... Scalarization of Local Aggregates ...
+//===----------------------------------------------------------------------===//
+
+// Small local structs, such as iterators, pairs and complex numbers, that are
+// only accessed a field at a time or copied as a whole are not given memory of
+// their own.  Instead each field is held in a separate local, and these are
+// promoted to registers once the function has been converted.  This way such
+// variables do not cause memory traffic even if the LLVM optimizers are not
+// run.
+
+/// isScalarizableType - Whether variables of the given type can have their
+/// fields held in separate locals: it must be a small struct with no bitfields
+/// or nested aggregates, every field of which has a corresponding LLVM field.
+static bool isScalarizableType(tree type) {
+  if (!isa<RECORD_TYPE>(type) || CostOfAccessingAllElements(type) >= TooCostly)
+    return false;
+  if (!isa<StructType>(ConvertType(type)))
+    return false;
+  for (tree Field = TYPE_FIELDS(type); Field; Field = TREE_CHAIN(Field)) {
+    if (!isa<FIELD_DECL>(Field))
+      continue;
+    if (isa<AGGREGATE_TYPE>(TREE_TYPE(Field)) || TREE_THIS_VOLATILE(Field) ||
+        integer_zerop(DECL_SIZE(Field)) ||
+        lookup_attribute("annotate", DECL_ATTRIBUTES(Field)))
+      return false;
+  }
+  return true;
+}
+
+/// isScalarizableDecl - Whether the given variable is a local aggregate that
+/// could have its fields held in separate locals, assuming it is only used in
+/// supported ways.
+static bool isScalarizableDecl(tree decl) {
+  return isa<VAR_DECL>(decl) && isLocalDecl(decl) && !TREE_ADDRESSABLE(decl) &&
+         !TREE_THIS_VOLATILE(decl) && !DECL_HAS_VALUE_EXPR_P(decl) &&
+         !DECL_HARD_REGISTER(decl) && !DECL_ATTRIBUTES(decl) &&
+         isScalarizableType(TREE_TYPE(decl));
+}
+
+/// ScalarizationCandidates - Map from the variables seen while scanning the
+/// function body to whether they can be scalarized.
+typedef DenseMap<tree, bool> ScalarizationCandidates;
+
+/// NoteScalarizationUse - Record a use of the given variable.  If isSimple is
+/// false then the use is one that stops the variable being scalarized.
+/// Returns the entry for the variable.
+static bool &NoteScalarizationUse(ScalarizationCandidates &Candidates,
+                                  tree decl, bool isSimple) {
+  std::pair<ScalarizationCandidates::iterator, bool> Entry =
+      Candidates.insert(std::make_pair(decl, false));
+  if (Entry.second)
+    Entry.first->second = isScalarizableDecl(decl);
+  if (!isSimple)
+    Entry.first->second = false;
+  return Entry.first->second;
+}
+
+/// FindScalarizationUses - Helper for FindScalarizableLocals, called by
+/// walk_tree.  Accessing a field of a variable is fine, any other appearance
+/// of the variable stops it from being scalarized.
+static tree FindScalarizationUses(tree *tp, int *walk_subtrees, void *data) {
+  ScalarizationCandidates &Candidates = *(ScalarizationCandidates *)data;
+  tree exp = *tp;
+
+  if (isa<COMPONENT_REF>(exp) && isa<VAR_DECL>(TREE_OPERAND(exp, 0))) {
+    tree decl = TREE_OPERAND(exp, 0);
+    bool &isCandidate = NoteScalarizationUse(Candidates, decl, true);
+    // Accessing the variable through a different struct type is not simple.
+    if (isCandidate && ConvertType(DECL_CONTEXT(TREE_OPERAND(exp, 1))) !=
+                       ConvertType(TREE_TYPE(decl)))
+      isCandidate = false;
+    *walk_subtrees = 0;
+    return NULL_TREE;
+  }
+
+  if (isa<VAR_DECL>(exp))
+    NoteScalarizationUse(Candidates, exp, false);
+  if (IS_TYPE_OR_DECL_P(exp))
+    *walk_subtrees = 0;
+  return NULL_TREE;
+}
+
+/// FindScalarizableLocals - Work out which local aggregates are only used in
+/// ways that allow their fields to be held in registers.
+void TreeToLLVM::FindScalarizableLocals() {
+  // Only scalarize if the GCC scalar replacement of aggregates pass would have
+  // been run.  Variables live across a setjmp need to be kept in memory.
+  if (!optimize || !flag_tree_sra || cfun->calls_setjmp)
+    return;
+
+  ScalarizationCandidates Candidates;
+  basic_block bb;
+  FOR_EACH_BB(bb) {
+    for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+         gsi_next(&gsi)) {
+      gimple stmt = gsi_stmt(gsi);
+      if (is_gimple_debug(stmt))
+        continue;
+
+      // Copying a variable to or from another aggregate of the same type, or
+      // zeroing it, is simple.
+      if (gimple_assign_single_p(stmt) &&
+          isa<AGGREGATE_TYPE>(TREE_TYPE(gimple_assign_lhs(stmt)))) {
+        tree lhs = gimple_assign_lhs(stmt);
+        tree rhs = gimple_assign_rhs1(stmt);
+        bool isCopy = !isa<CONSTRUCTOR>(rhs);
+        bool isSimple = isCopy ? TYPE_MAIN_VARIANT(TREE_TYPE(lhs)) ==
+                                 TYPE_MAIN_VARIANT(TREE_TYPE(rhs))
+                               : CONSTRUCTOR_NELTS(rhs) == 0;
+        if (isa<VAR_DECL>(lhs))
+          NoteScalarizationUse(Candidates, lhs, isSimple);
+        else
+          walk_tree(gimple_assign_lhs_ptr(stmt), FindScalarizationUses,
+                    &Candidates, NULL);
+        if (isCopy && isa<VAR_DECL>(rhs))
+          NoteScalarizationUse(Candidates, rhs, isSimple);
+        else
+          walk_tree(gimple_assign_rhs1_ptr(stmt), FindScalarizationUses,
+                    &Candidates, NULL);
+        continue;
+      }
+
+      for (unsigned i = 0, e = gimple_num_ops(stmt); i != e; ++i)
+        walk_tree(gimple_op_ptr(stmt, i), FindScalarizationUses, &Candidates,
+                  NULL);
+    }
+  }
+
+  for (ScalarizationCandidates::iterator I = Candidates.begin(),
+       E = Candidates.end(); I != E; ++I)
+    if (I->second) {
+      unsigned NumFields =
+          cast<StructType>(ConvertType(TREE_TYPE(I->first)))->getNumElements();
+      ScalarizedLocals[I->first].resize(NumFields, 0);
+      ++NumScalarizedLocals;
+    }
+}
+
+/// getScalarizedFieldLoc - Return the local holding the given field of the
+/// scalarized local aggregate decl.
+MemRef TreeToLLVM::getScalarizedFieldLoc(tree decl, tree Field) {
+  assert(isScalarizedLocal(decl) && "Variable was not scalarized!");
+  unsigned FieldIdx = GetFieldIndex(Field, ConvertType(TREE_TYPE(decl)));
+  AllocaInst *&FieldLoc = ScalarizedLocals[decl][FieldIdx];
+  if (!FieldLoc) {
+    Type *FieldTy = ConvertType(TREE_TYPE(Field));
+    FieldLoc = CreateTemporary(FieldTy, DL.getPrefTypeAlignment(FieldTy));
+    NameValue(FieldLoc, decl);
+    ScalarizedFieldLocals.push_back(FieldLoc);
+  }
+  return MemRef(FieldLoc, FieldLoc->getAlignment(), false);
+}
+
+/// getAggregateFieldLoc - Return the location of the given field of exp, which
+/// is either a scalarized local or an aggregate in memory at Loc.
+MemRef TreeToLLVM::getAggregateFieldLoc(tree exp, MemRef Loc, tree Field) {
+  if (isScalarizedLocal(exp))
+    return getScalarizedFieldLoc(exp, Field);
+
+  FieldLayout Layout = GetFieldLayout(Field, ConvertType(TREE_TYPE(exp)));
+  unsigned FieldIdx = Layout.Index;
+  Value *FieldPtr =
+      Builder.CreateStructGEP(Loc.Ptr, FieldIdx, flag_verbose_asm ? "sf" : "");
+  unsigned FieldAlign = Loc.getAlignment();
+  if (FieldIdx)
+    FieldAlign = MinAlign(FieldAlign, Layout.Alignment);
+  return MemRef(FieldPtr, FieldAlign, Loc.Volatile);
+}
+
+/// EmitScalarizedAggregateCopy - Assign rhs to lhs, where at least one of them
+/// is a scalarized local.  If rhs is an empty constructor then lhs is zeroed.
+void TreeToLLVM::EmitScalarizedAggregateCopy(tree lhs, tree rhs) {
+  tree type = TREE_TYPE(lhs);
+  Type *Ty = ConvertType(type);
+  bool isZero = isa<CONSTRUCTOR>(rhs);
+
+  // Get the address of whichever sides live in memory.
+  MemRef DestLoc, SrcLoc;
+  if (!isScalarizedLocal(lhs)) {
+    LValue LV = EmitLV(lhs);
+    DestLoc = MemRef(Builder.CreateBitCast(LV.Ptr, Ty->getPointerTo()),
+                     LV.getAlignment(), TREE_THIS_VOLATILE(lhs));
+  }
+  if (!isZero && !isScalarizedLocal(rhs)) {
+    LValue LV = EmitLV(rhs);
+    SrcLoc = MemRef(Builder.CreateBitCast(LV.Ptr, Ty->getPointerTo()),
+                    LV.getAlignment(), TREE_THIS_VOLATILE(rhs));
+  }
+
+  // Copy each field in turn.
+  for (tree Field = TYPE_FIELDS(type); Field; Field = TREE_CHAIN(Field)) {
+    if (!isa<FIELD_DECL>(Field))
+      continue;
+    tree FieldType = TREE_TYPE(Field);
+    MDNode *AliasTag = describeAliasSet(FieldType);
+    Value *Val = isZero ? Constant::getNullValue(getRegType(FieldType))
+                        : LoadRegisterFromMemory(
+                              getAggregateFieldLoc(rhs, SrcLoc, Field),
+                              FieldType, AliasTag, Builder);
+    StoreRegisterToMemory(Val, getAggregateFieldLoc(lhs, DestLoc, Field),
+                          FieldType, AliasTag, Builder);
+  }
+}
+
+/// PromoteScalarizedLocals - Turn the field locals of scalarized aggregates
+/// into registers.
+void TreeToLLVM::PromoteScalarizedLocals() {
+  std::vector<AllocaInst *> Allocas;
+  for (unsigned i = 0, e = ScalarizedFieldLocals.size(); i != e; ++i)
+    // A field that is only accessed through a differently typed pointer, like
+    // the parts of a complex number, stays in memory.
+    if (isAllocaPromotable(ScalarizedFieldLocals[i]))
+      Allocas.push_back(ScalarizedFieldLocals[i]);
+  if (Allocas.empty())
+    return;
+
+  DominatorTree DT;
+  DT.recalculate(*Fn);
+  PromoteMemToReg(Allocas, DT);
+}
+
 //===----------------------------------------------------------------------===//
 //                           ... Control Flow ...
 //===----------------------------------------------------------------------===//
@@ -3169,8 +3624,8 @@ struct FunctionCallArgumentConversion : public DefaultABIClient {
       Value *Buf = TheTreeToLLVM->CreateTemporary(PtrArgTy->getElementType());
       CallOperands.push_back(Buf);
     } else if (useReturnSlot) {
-      // Letting the call write directly to the final destination is safe and
-      // may be required.  Do not use a buffer.
+      // Letting the call write directly to the final destination is safe, and
+      // may be required by GCC.  Do not use a buffer.
       CallOperands.push_back(DestLoc->Ptr);
     } else {
       // Letting the call write directly to the final destination may not be
@@ -3276,6 +3731,37 @@ struct FunctionCallArgumentConversion : public DefaultABIClient {
 };
 }
 
+/// canForwardReturnSlot - Return true if an aggregate result of the given call
+/// that is returned via a shadow argument can be written by the callee straight
+/// into the left-hand side of the call, rather than into a temporary which is
+/// then copied to the left-hand side.  This requires that the callee cannot
+/// read or write the left-hand side by any other route while it runs.
+static bool canForwardReturnSlot(gimple stmt) {
+  // GCC has already determined that this is safe.
+  if (gimple_call_return_slot_opt_p(stmt))
+    return true;
+
+  tree lhs = gimple_call_lhs(stmt);
+  if (!lhs || TREE_THIS_VOLATILE(lhs))
+    return false;
+
+  // The left-hand side must be part of a local variable or of the function
+  // result whose address does not escape, so it cannot be reached through any
+  // pointer the callee has access to.
+  tree base = get_base_address(lhs);
+  if (!base || !(isa<VAR_DECL>(base) || isa<RESULT_DECL>(base)) ||
+      TREE_ADDRESSABLE(base) || TREE_STATIC(base) || DECL_EXTERNAL(base) ||
+      TREE_THIS_VOLATILE(base))
+    return false;
+
+  // Nor may it be passed to the callee, for example by value in memory.
+  for (unsigned i = 0, e = gimple_call_num_args(stmt); i != e; ++i)
+    if (get_base_address(gimple_call_arg(stmt, i)) == base)
+      return false;
+
+  return true;
+}
+
 /// EmitCallOf - Emit a call to the specified callee with the operands specified
 /// in the GIMPLE_CALL 'stmt'. If the result of the call is a scalar, return the
 /// result, otherwise store it in DestLoc.
@@ -3337,8 +3823,8 @@ Value *TreeToLLVM::EmitCallOf(Value *Callee, gimple stmt, const MemRef *DestLoc,
   PointerType *PFTy = cast<PointerType>(Callee->getType());
   FunctionType *FTy = cast<FunctionType>(PFTy->getElementType());
   FunctionCallArgumentConversion Client(CallOperands, FTy, DestLoc,
-                                        gimple_call_return_slot_opt_p(stmt),
-                                        Builder, CallingConvention);
+                                        canForwardReturnSlot(stmt), Builder,
+                                        CallingConvention);
   DefaultABI ABIConverter(Client);
 
   // Handle the result, including struct returns.
@@ -3423,8 +3909,42 @@ Value *TreeToLLVM::EmitCallOf(Value *Callee, gimple stmt, const MemRef *DestLoc,
     for (unsigned i = CallOperands.size(), e = FTy->getNumParams(); i != e; ++i)
       CallOperands.push_back(UndefValue::get(FTy->getParamType(i)));
 
+  // If profiling indirect calls, record the function called.  If using an
+  // indirect call profile, find out which functions are worth calling directly.
+  SmallVector<std::pair<Function *, uint64_t>, 2> DirectTargets;
+  uint64_t TotalCalls = 0;
+  if (!isa<Constant>(Callee) &&
+      (ICallProfileGenerateFile || ICallProfileUseFile)) {
+    uint64_t SiteID = getIndirectCallSiteID(Fn);
+    if (ICallProfileGenerateFile)
+      Builder.CreateCall2(getIndirectCallRecorder(),
+                          getIndirectCallCounters(SiteID),
+                          Builder.CreateBitCast(Callee,
+                                                Type::getInt8PtrTy(Context)));
+    if (ICallProfileUseFile && !LandingPad)
+      getIndirectCallTargets(SiteID, FTy, CallingConvention, DirectTargets,
+                             TotalCalls);
+  }
+
+  // Calls to functions that do not return, such as abort or exit, are on cold
+  // paths.
+  if (gimple_call_flags(stmt) & ECF_NORETURN)
+    PAL = PAL.addAttribute(Context, AttributeSet::FunctionIndex,
+                           Attribute::Cold);
+
+  // Calls made by a function with the flatten attribute should be inlined if
+  // at all possible.
+  if (fndecl &&
+      lookup_attribute("flatten", DECL_ATTRIBUTES(current_function_decl)) &&
+      !lookup_attribute("noinline", DECL_ATTRIBUTES(fndecl)))
+    PAL = PAL.addAttribute(Context, AttributeSet::FunctionIndex,
+                           Attribute::AlwaysInline);
+
   Value *Call;
-  if (!LandingPad) {
+  if (!DirectTargets.empty()) {
+    Call = EmitPromotedIndirectCall(Callee, CallOperands, CallingConvention,
+                                    PAL, DirectTargets, TotalCalls);
+  } else if (!LandingPad) {
     Call = Builder.CreateCall(Callee, CallOperands);
     cast<CallInst>(Call)->setCallingConv(CallingConvention);
     cast<CallInst>(Call)->setAttributes(PAL);
@@ -3457,19 +3977,25 @@ Value *TreeToLLVM::EmitCallOf(Value *Callee, gimple stmt, const MemRef *DestLoc,
 
   if (Client.isAggrReturn()) {
     MemRef Target;
-    if (DestLoc)
+    if (DestLoc) {
       Target = *DestLoc;
-    else
-      // Destination is a first class value (eg: a complex number).  Extract to
-      // a temporary then load the value out later.
-      Target = CreateTempLoc(ConvertType(gimple_call_return_type(stmt)));
+    } else {
+      // Destination is a first class value (eg: a complex number).  If it was
+      // returned in registers of exactly the right type then use them as is.
+      Type *RetTy = ConvertType(gimple_call_return_type(stmt));
+      if (Call->getType() == RetTy)
+        return Call;
+      // Otherwise extract to a temporary then load the value out later.
+      Target = CreateTempLoc(RetTy);
+    }
 
     if (DL.getTypeAllocSize(Call->getType()) <=
         DL.getTypeAllocSize(cast<PointerType>(Target.Ptr->getType())
                                 ->getElementType())) {
       Value *Dest =
           Builder.CreateBitCast(Target.Ptr, Call->getType()->getPointerTo());
-      LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Call, Dest, Target.Volatile, Builder);
+      LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Call, Dest, Target.getAlignment(),
+                                         Target.Volatile, Builder);
     } else {
       // The call will return an aggregate value in registers, but
       // those registers are bigger than Target.  Allocate a
@@ -3477,14 +4003,11 @@ Value *TreeToLLVM::EmitCallOf(Value *Callee, gimple stmt, const MemRef *DestLoc,
       // cast the temporary into the correct (smaller) type, and using
       // the correct type, copy the value into Target.  Assume the
       // optimizer will delete the temporary and clean this up.
-      AllocaInst *biggerTmp = CreateTemporary(Call->getType());
-      LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Call, biggerTmp, /*Volatile=*/ false,
-                                         Builder);
-      EmitAggregateCopy(
-          Target, MemRef(Builder.CreateBitCast(biggerTmp,
-                                               Call->getType()->getPointerTo()),
-                         Target.getAlignment(), Target.Volatile),
-          gimple_call_return_type(stmt));
+      MemRef biggerTmp = CreateTempLoc(Call->getType());
+      LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(Call, biggerTmp.Ptr,
+                                         biggerTmp.getAlignment(),
+                                         /*Volatile=*/ false, Builder);
+      EmitAggregateCopy(Target, biggerTmp, gimple_call_return_type(stmt));
     }
 
     return DestLoc ? 0 : Builder.CreateLoad(Target.Ptr);
@@ -3552,6 +4075,63 @@ Value *TreeToLLVM::EmitCallOf(Value *Callee, gimple stmt, const MemRef *DestLoc,
   return 0;
 }
 
+/// getBranchWeight - Scale the given count down to fit in a branch weight.
+static uint32_t getBranchWeight(uint64_t Count, uint64_t Total) {
+  unsigned Shift = 0;
+  while ((Total >> Shift) > ~0U)
+    ++Shift;
+  return (uint32_t)(Count >> Shift);
+}
+
+/// EmitPromotedIndirectCall - Emit an indirect call to Callee, preceded by
+/// tests of whether Callee is one of the given frequently called functions.  If
+/// it is then that function is called directly, allowing it to be inlined.
+/// Total is the number of times the call was executed when profiling.  Returns
+/// the result of the call.
+Value *TreeToLLVM::EmitPromotedIndirectCall(
+    Value *Callee, ArrayRef<Value *> Ops, CallingConv::ID CC,
+    const AttributeSet &PAL, ArrayRef<std::pair<Function *, uint64_t> > Targets,
+    uint64_t Total) {
+  BasicBlock *Done = BasicBlock::Create(Context, "icall.done");
+  SmallVector<std::pair<CallInst *, BasicBlock *>, 3> Results;
+  MDBuilder MDHelper(Context);
+
+  for (unsigned i = 0, e = Targets.size(); i != e; ++i) {
+    Function *F = Targets[i].first;
+    uint64_t Count = std::min(Targets[i].second, Total);
+    BasicBlock *Direct = BasicBlock::Create(Context, "icall.direct");
+    BasicBlock *Next = BasicBlock::Create(Context, "icall.next");
+    Builder.CreateCondBr(
+        Builder.CreateICmpEQ(Callee, F), Direct, Next,
+        MDHelper.createBranchWeights(getBranchWeight(Count, Total),
+                                     getBranchWeight(Total - Count, Total)));
+    Total -= Count;
+
+    BeginBlock(Direct);
+    CallInst *Call = Builder.CreateCall(F, Ops);
+    Call->setCallingConv(CC);
+    Call->setAttributes(PAL);
+    Results.push_back(std::make_pair(Call, Builder.GetInsertBlock()));
+    Builder.CreateBr(Done);
+
+    BeginBlock(Next);
+  }
+
+  // None of the frequent targets: do the indirect call.
+  CallInst *Call = Builder.CreateCall(Callee, Ops);
+  Call->setCallingConv(CC);
+  Call->setAttributes(PAL);
+  Results.push_back(std::make_pair(Call, Builder.GetInsertBlock()));
+  BeginBlock(Done);
+
+  if (Call->getType()->isVoidTy())
+    return Call;
+  PHINode *PHI = Builder.CreatePHI(Call->getType(), Results.size());
+  for (unsigned i = 0, e = Results.size(); i != e; ++i)
+    PHI->addIncoming(Results[i].first, Results[i].second);
+  return PHI;
+}
+
 /// EmitSimpleCall - Emit a call to the function with the given name and return
 /// type, passing the provided arguments (which should all be gimple registers
 /// or local constants of register type).  No marshalling is done: the arguments
@@ -5412,6 +5992,9 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
         if (Client.isShadowReturn())
           return Client.EmitShadowResult(cplx_type, 0);
 
+        if (CI->getType() == CplxTy)
+          return CI; // Normal scalar return.
+
         if (Client.isAggrReturn()) {
           // Extract to a temporary then load the value out later.
           MemRef Target = CreateTempLoc(CplxTy);
@@ -5421,14 +6004,11 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
                  "Complex number returned in too large registers!");
           Value *Dest =
               Builder.CreateBitCast(Target.Ptr, CI->getType()->getPointerTo());
-          LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(CI, Dest, Target.Volatile,
-                                             Builder);
+          LLVM_EXTRACT_MULTIPLE_RETURN_VALUE(CI, Dest, Target.getAlignment(),
+                                             Target.Volatile, Builder);
           return Builder.CreateLoad(Target.Ptr);
         }
 
-        if (CI->getType() == CplxTy)
-          return CI; // Normal scalar return.
-
         // Probably { float, float } being returned as a double.
         assert(DL.getTypeAllocSize(CI->getType()) ==
                DL.getTypeAllocSize(CplxTy) &&
@@ -5452,12 +6032,105 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
                                 ConvertType(gimple_call_return_type(stmt)));
     }
 
+    /// ConstantPMarkerPrefix - The name of the functions used to mark calls to
+    /// __builtin_constant_p that could not be decided when converting starts
+    /// with this, followed by the type of the argument.
+    static const char ConstantPMarkerPrefix[] = "dragonegg.constant_p.";
+
+    /// isKnownConstant - Whether V is a constant in the sense of
+    /// __builtin_constant_p: a number, a null pointer or a string literal.
+    static bool isKnownConstant(Value *V) {
+      if (isa<ConstantInt>(V) || isa<ConstantFP>(V) ||
+          isa<ConstantPointerNull>(V))
+        return true;
+      GlobalVariable *GV =
+          llvm::dyn_cast<GlobalVariable>(V->stripPointerCasts());
+      return GV && GV->isConstant() && GV->hasPrivateLinkage() &&
+             GV->hasUnnamedAddr() && GV->hasDefinitiveInitializer() &&
+             isa<ConstantDataSequential>(GV->getInitializer());
+    }
+
     bool TreeToLLVM::EmitBuiltinConstantP(gimple stmt, Value * &Result) {
-      Result =
-          Constant::getNullValue(ConvertType(gimple_call_return_type(stmt)));
+      Type *ResultTy = ConvertType(gimple_call_return_type(stmt));
+      tree arg = gimple_call_arg(stmt, 0);
+      tree type = TREE_TYPE(arg);
+
+      // Only numbers and pointers can be constant.
+      if (!isa<INTEGRAL_TYPE>(type) && !isa<REAL_TYPE>(type) &&
+          !isa<ACCESS_TYPE>(type)) {
+        Result = Constant::getNullValue(ResultTy);
+        return true;
+      }
+
+      Value *Arg = EmitMemory(arg);
+      if (isKnownConstant(Arg)) {
+        Result = ConstantInt::get(ResultTy, 1);
+        return true;
+      }
+      if (!optimize) {
+        Result = Constant::getNullValue(ResultTy);
+        return true;
+      }
+
+      // The argument may become constant once inlining and constant propagation
+      // have been done, so leave the decision until later, see
+      // FoldBuiltinConstantP.  Use a call to a function that does nothing as a
+      // placeholder.
+      std::string Name = ConstantPMarkerPrefix;
+      raw_string_ostream OS(Name);
+      Arg->getType()->print(OS);
+      Type *Int1Ty = Type::getInt1Ty(Context);
+      Constant *Marker = TheModule->getOrInsertFunction(
+          OS.str(), FunctionType::get(Int1Ty, Arg->getType(), false));
+      if (Function *F = llvm::dyn_cast<Function>(Marker)) {
+        F->setDoesNotAccessMemory();
+        F->setDoesNotThrow();
+      }
+      Result = Builder.CreateZExt(Builder.CreateCall(Marker, Arg), ResultTy);
       return true;
     }
 
+    /// FoldBuiltinConstantP - Replace the placeholders left in F by calls to
+    /// __builtin_constant_p with the answer if the argument is now a constant.
+    /// If Final is true then it is too late for the argument to become constant
+    /// and all placeholders are replaced.  Returns whether anything changed.
+    bool FoldBuiltinConstantP(Function &F, bool Final) {
+      SmallVector<CallInst *, 4> Calls;
+      for (Function::iterator BB = F.begin(), BE = F.end(); BB != BE; ++BB)
+        for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I)
+          if (CallInst *CI = llvm::dyn_cast<CallInst>(I))
+            if (Function *Callee = CI->getCalledFunction())
+              if (Callee->getName().startswith(ConstantPMarkerPrefix) &&
+                  (Final || isKnownConstant(CI->getArgOperand(0))))
+                Calls.push_back(CI);
+
+      // Simplify the users too, so that the code for the other answer is seen
+      // to be dead.  This deletes the call.
+      for (unsigned i = 0, e = Calls.size(); i != e; ++i) {
+        bool IsConstant = isKnownConstant(Calls[i]->getArgOperand(0));
+        replaceAndRecursivelySimplify(
+            Calls[i], ConstantInt::get(Calls[i]->getType(), IsConstant));
+      }
+      return !Calls.empty();
+    }
+
+    /// FinishBuiltinConstantP - Replace all remaining __builtin_constant_p
+    /// placeholders in the module, and delete the placeholder functions.
+    void FinishBuiltinConstantP(Module &M) {
+      for (Module::iterator FI = M.begin(), FE = M.end(); FI != FE;) {
+        Function *Marker = FI++;
+        if (!Marker->getName().startswith(ConstantPMarkerPrefix))
+          continue;
+        while (!Marker->use_empty()) {
+          CallInst *CI = cast<CallInst>(Marker->user_back());
+          bool IsConstant = isKnownConstant(CI->getArgOperand(0));
+          replaceAndRecursivelySimplify(
+              CI, ConstantInt::get(CI->getType(), IsConstant));
+        }
+        Marker->eraseFromParent();
+      }
+    }
+
     bool TreeToLLVM::EmitBuiltinExtendPointer(gimple stmt, Value * &Result) {
       tree arg0 = gimple_call_arg(stmt, 0);
       Value *Amt = EmitMemory(arg0);
@@ -6305,6 +6978,13 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
     }
 
     LValue TreeToLLVM::EmitLV_COMPONENT_REF(tree exp) {
+      // The fields of a scalarized local live in locals of their own.
+      if (isScalarizedLocal(TREE_OPERAND(exp, 0))) {
+        MemRef FieldLoc =
+            getScalarizedFieldLoc(TREE_OPERAND(exp, 0), TREE_OPERAND(exp, 1));
+        return LValue(FieldLoc);
+      }
+
       LValue StructAddrLV = EmitLV(TREE_OPERAND(exp, 0));
       tree FieldDecl = TREE_OPERAND(exp, 1);
       unsigned LVAlign = StructAddrLV.getAlignment();
@@ -6320,15 +7000,17 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
           Builder.CreateBitCast(StructAddrLV.Ptr, StructTy->getPointerTo());
       Type *FieldTy = ConvertType(TREE_TYPE(FieldDecl));
 
+      // Where the field lies in the struct, worked out when it was converted.
+      FieldLayout Layout = GetFieldLayout(FieldDecl, StructTy);
+
       // BitStart - This is the actual offset of the field from the start of the
       // struct, in bits.  For bitfields this may be on a non-byte boundary.
-      uint64_t FieldBitOffset =
-          getInt64(DECL_FIELD_BIT_OFFSET(FieldDecl), true);
+      uint64_t FieldBitOffset = Layout.BitOffset;
       unsigned BitStart;
       Value *FieldPtr;
 
       // If the GCC field directly corresponds to an LLVM field, handle it.
-      unsigned MemberIndex = GetFieldIndex(FieldDecl, StructTy);
+      unsigned MemberIndex = Layout.Index;
       if (MemberIndex < INT_MAX) {
         assert(!TREE_OPERAND(exp, 2) && "Constant not gimple min invariant?");
         // Get a pointer to the byte in which the GCC field starts.
@@ -6378,7 +7060,7 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
 
       // Compute the alignment of the octet containing the first bit of the field,
       // without assuming that the containing struct itself is properly aligned.
-      LVAlign = MinAlign(LVAlign, getFieldAlignment(FieldDecl));
+      LVAlign = MinAlign(LVAlign, Layout.Alignment);
 
       // If the FIELD_DECL has an annotate attribute on it, emit it.
       if (lookup_attribute("annotate", DECL_ATTRIBUTES(FieldDecl)))
@@ -6388,7 +7070,7 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
       Type *EltTy = ConvertType(TREE_TYPE(exp));
       FieldPtr = Builder.CreateBitCast(FieldPtr, EltTy->getPointerTo());
 
-      if (!isBitfield(FieldDecl)) {
+      if (!Layout.Bitfield) {
         assert(BitStart == 0 && "Not a bitfield but not at a byte offset!");
         return LValue(FieldPtr, LVAlign);
       }
@@ -7197,19 +7879,33 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
       return Builder.CreateSelect(Compare, LHS, RHS);
     }
 
+    /// VectorReductionShuffle - Return a vector whose first Elts elements are
+    /// elements [Elts, 2*Elts) of the given vector, the rest being undefined.
+    static Value *VectorReductionShuffle(Value *Val, unsigned Elts,
+                                         LLVMBuilder &Builder) {
+      Type *Ty = Val->getType();
+      unsigned Length = cast<VectorType>(Ty)->getNumElements();
+      SmallVector<Constant *, 8> Mask(
+          Length, UndefValue::get(Type::getInt32Ty(Context)));
+      for (unsigned i = 0; i != Elts; ++i)
+        Mask[i] = Builder.getInt32(Elts + i);
+      return Builder.CreateShuffleVector(Val, UndefValue::get(Ty),
+                                         ConstantVector::get(Mask));
+    }
+
     Value *TreeToLLVM::EmitReg_ReducMinMaxExpr(
         tree op, unsigned UIPred, unsigned SIPred, unsigned FPPred) {
-      // In the bottom half of the vector, form the max/min of the bottom and top
-      // halves of the vector.  Rinse and repeat on the just computed bottom half:
-      // in the bottom quarter of the vector, form the max/min of the bottom and
-      // top halves of the bottom half.  Continue until only the first element of
-      // the vector is computed.  For example, reduc-max <x0, x1, x2, x3> becomes
-      //   v = max <x0, x1, undef, undef>, <x2, x3, undef, undef>
-      //   w = max <v0, undef, undef, undef>, <v1, undef, undef, undef>
-      // where v = <v0, v1, undef, undef>.  The first element of w is the max/min
-      // of x0,x1,x2,x3.
+      // Form the max/min of the vector and its top half moved down to the bottom
+      // half.  Rinse and repeat on the just computed bottom half, until only the
+      // first element of the vector is computed.  For example, reduc-max
+      // <x0, x1, x2, x3> becomes
+      //   v = max <x0, x1, x2, x3>, <x2, x3, undef, undef>
+      //   w = max v, <v1, undef, undef, undef>
+      // where v = <v0, v1, ...>.  The first element of w is the max/min of
+      // x0,x1,x2,x3.  This is the form produced by the LLVM vectorizers, and
+      // which the code generators turn into the best horizontal sequence for the
+      // target.
       Value *Val = EmitRegister(op);
-      Type *Ty = Val->getType();
 
       CmpInst::Predicate Pred = CmpInst::Predicate(
           isa<FLOAT_TYPE>(TREE_TYPE(op)) ? FPPred : TYPE_UNSIGNED(TREE_TYPE(op))
@@ -7219,28 +7915,14 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
       unsigned Length = (unsigned) TYPE_VECTOR_SUBPARTS(TREE_TYPE(op));
       assert(Length > 1 && !(Length & (Length - 1)) &&
              "Length not a power of 2!");
-      SmallVector<Constant *, 8> Mask(Length);
-      Constant *UndefIndex = UndefValue::get(Type::getInt32Ty(Context));
       for (unsigned Elts = Length >> 1; Elts; Elts >>= 1) {
-        // In the extracted vectors, elements with index Elts and on are undefined.
-        for (unsigned i = Elts; i != Length; ++i)
-          Mask[i] = UndefIndex;
-        // Extract elements [0, Elts) from Val.
-        for (unsigned i = 0; i != Elts; ++i)
-          Mask[i] = Builder.getInt32(i);
-        Value *LHS = Builder.CreateShuffleVector(Val, UndefValue::get(Ty),
-                                                 ConstantVector::get(Mask));
-        // Extract elements [Elts, 2*Elts) from Val.
-        for (unsigned i = 0; i != Elts; ++i)
-          Mask[i] = Builder.getInt32(Elts + i);
-        Value *RHS = Builder.CreateShuffleVector(Val, UndefValue::get(Ty),
-                                                 ConstantVector::get(Mask));
-
-        // Replace Val with the max/min of the extracted elements.
+        Value *High = VectorReductionShuffle(Val, Elts, Builder);
+
+        // Replace Val with the max/min of it and its top half.
         Value *Compare =
-            isa<FLOAT_TYPE>(TREE_TYPE(op)) ? Builder.CreateFCmp(Pred, LHS, RHS)
-                                           : Builder.CreateICmp(Pred, LHS, RHS);
-        Val = Builder.CreateSelect(Compare, LHS, RHS);
+            isa<FLOAT_TYPE>(TREE_TYPE(op)) ? Builder.CreateFCmp(Pred, Val, High)
+                                           : Builder.CreateICmp(Pred, Val, High);
+        Val = Builder.CreateSelect(Compare, Val, High);
 
         // Repeat, using half as many elements.
       }
@@ -7249,40 +7931,27 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
     }
 
     Value *TreeToLLVM::EmitReg_REDUC_PLUS_EXPR(tree op) {
-      // In the bottom half of the vector, form the sum of the bottom and top halves
-      // of the vector.  Rinse and repeat on the just computed bottom half: in the
-      // bottom quarter of the vector, form the sum of the bottom and top halves of
-      // the bottom half.  Continue until only the first element of the vector is
-      // computed.  For example, reduc-plus <x0, x1, x2, x3> becomes
-      //   v = <x0, x1, undef, undef> + <x2, x3, undef, undef>
-      //   w = <v0, undef, undef, undef> + <v1, undef, undef, undef>
-      // where v = <v0, v1, undef, undef>.  The first element of w is x0+x1+x2+x3.
+      // Form the sum of the vector and its top half moved down to the bottom
+      // half.  Rinse and repeat on the just computed bottom half, until only the
+      // first element of the vector is computed.  For example, reduc-plus
+      // <x0, x1, x2, x3> becomes
+      //   v = <x0, x1, x2, x3> + <x2, x3, undef, undef>
+      //   w = v + <v1, undef, undef, undef>
+      // where v = <v0, v1, ...>.  The first element of w is x0+x1+x2+x3.  This is
+      // the form produced by the LLVM vectorizers, and which the code generators
+      // turn into the best horizontal sequence for the target.  Floating point
+      // additions get the fast-math flags of the function.
       Value *Val = EmitRegister(op);
-      Type *Ty = Val->getType();
 
       unsigned Length = (unsigned) TYPE_VECTOR_SUBPARTS(TREE_TYPE(op));
       assert(Length > 1 && !(Length & (Length - 1)) &&
              "Length not a power of 2!");
-      SmallVector<Constant *, 8> Mask(Length);
-      Constant *UndefIndex = UndefValue::get(Type::getInt32Ty(Context));
       for (unsigned Elts = Length >> 1; Elts; Elts >>= 1) {
-        // In the extracted vectors, elements with index Elts and on are undefined.
-        for (unsigned i = Elts; i != Length; ++i)
-          Mask[i] = UndefIndex;
-        // Extract elements [0, Elts) from Val.
-        for (unsigned i = 0; i != Elts; ++i)
-          Mask[i] = Builder.getInt32(i);
-        Value *LHS = Builder.CreateShuffleVector(Val, UndefValue::get(Ty),
-                                                 ConstantVector::get(Mask));
-        // Extract elements [Elts, 2*Elts) from Val.
-        for (unsigned i = 0; i != Elts; ++i)
-          Mask[i] = Builder.getInt32(Elts + i);
-        Value *RHS = Builder.CreateShuffleVector(Val, UndefValue::get(Ty),
-                                                 ConstantVector::get(Mask));
-
-        // Replace Val with the sum of the extracted elements.
+        Value *High = VectorReductionShuffle(Val, Elts, Builder);
+
+        // Replace Val with the sum of it and its top half.
         // TODO: Are nsw/nuw flags valid here?
-        Val = CreateAnyAdd(LHS, RHS, TREE_TYPE(TREE_TYPE(op)));
+        Val = CreateAnyAdd(Val, High, TREE_TYPE(TREE_TYPE(op)));
 
         // Repeat, using half as many elements.
       }
@@ -7291,25 +7960,9 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
     }
 
     Value *TreeToLLVM::EmitReg_RotateOp(tree type, tree op0, tree op1,
-                                        unsigned Opc1, unsigned Opc2) {
-      Value *In = EmitRegister(op0);
-      Value *Amt = EmitRegister(op1);
-
-      if (Amt->getType() != In->getType())
-        Amt = Builder.CreateIntCast(Amt, In->getType(), /*isSigned*/ false,
-                                    Amt->getName() + ".cast");
-
-      Value *TypeSize = ConstantInt::get(
-          In->getType(), In->getType()->getPrimitiveSizeInBits());
-
-      // Do the two shifts.
-      Value *V1 = Builder.CreateBinOp((Instruction::BinaryOps) Opc1, In, Amt);
-      Value *OtherShift = Builder.CreateSub(TypeSize, Amt);
-      Value *V2 =
-          Builder.CreateBinOp((Instruction::BinaryOps) Opc2, In, OtherShift);
-
-      // Or the two together to return them.
-      Value *Merge = Builder.CreateOr(V1, V2);
+                                        bool isLeftRotate) {
+      Value *Merge =
+          EmitRotate(EmitRegister(op0), EmitRegister(op1), isLeftRotate);
       return Builder.CreateIntCast(Merge, getRegType(type), /*isSigned*/ false);
     }
 
@@ -8089,6 +8742,16 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
 
     Value *TreeToLLVM::EmitReg_VEC_WIDEN_MULT_HI_EXPR(tree type, tree op0,
                                                       tree op1) {
+#ifdef LLVM_TARGET_VEC_WIDEN_MULT
+      // Eg: <4 x i32> = VEC_WIDEN_MULT_HI_EXPR(<8 x i16>, <8 x i16>).  Targets
+      // may have instructions that produce the wide products directly.
+      Value *Result;
+      if (LLVM_TARGET_VEC_WIDEN_MULT(
+              getRegType(type), EmitRegister(op0), EmitRegister(op1),
+              /*isHigh*/ true, !TYPE_UNSIGNED(TREE_TYPE(TREE_TYPE(op0))),
+              Result))
+        return Result;
+#endif
       Value *Hi0 = EmitReg_VecUnpackHiExpr(type, op0);
       Value *Hi1 = EmitReg_VecUnpackHiExpr(type, op1);
       return Builder.CreateMul(Hi0, Hi1);
@@ -8096,6 +8759,14 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
 
     Value *TreeToLLVM::EmitReg_VEC_WIDEN_MULT_LO_EXPR(tree type, tree op0,
                                                       tree op1) {
+#ifdef LLVM_TARGET_VEC_WIDEN_MULT
+      Value *Result;
+      if (LLVM_TARGET_VEC_WIDEN_MULT(
+              getRegType(type), EmitRegister(op0), EmitRegister(op1),
+              /*isHigh*/ false, !TYPE_UNSIGNED(TREE_TYPE(TREE_TYPE(op0))),
+              Result))
+        return Result;
+#endif
       Value *Lo0 = EmitReg_VecUnpackLoExpr(type, op0);
       Value *Lo1 = EmitReg_VecUnpackLoExpr(type, op1);
       return Builder.CreateMul(Lo0, Lo1);
@@ -8678,7 +9349,8 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
         // code to read from RESULT_DECLs before returning from the function, so
         // saying that a RESULT_DECL is dead means we are dead - which is why we
         // don't even consider it.
-        if (isa<PARM_DECL>(lhs) || isa<VAR_DECL>(lhs)) {
+        if ((isa<PARM_DECL>(lhs) || isa<VAR_DECL>(lhs)) &&
+            !isScalarizedLocal(lhs)) {
           Value *LHSAddr =
               Builder.CreateBitCast(DECL_LOCAL(lhs), Builder.getInt8PtrTy());
           uint64_t LHSSize =
@@ -8695,9 +9367,14 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
       if (isa<AGGREGATE_TYPE>(TREE_TYPE(lhs))) {
         assert(get_gimple_rhs_class(gimple_expr_code(stmt)) ==
                GIMPLE_SINGLE_RHS && "Aggregate type but rhs not simple!");
+        tree rhs = gimple_assign_rhs1(stmt);
+        if (isScalarizedLocal(lhs) || isScalarizedLocal(rhs)) {
+          EmitScalarizedAggregateCopy(lhs, rhs);
+          return;
+        }
         LValue LV = EmitLV(lhs);
         MemRef NewLoc(LV.Ptr, LV.getAlignment(), TREE_THIS_VOLATILE(lhs));
-        EmitAggregate(gimple_assign_rhs1(stmt), NewLoc);
+        EmitAggregate(rhs, NewLoc);
         return;
       }
       WriteScalarToLHS(lhs, EmitAssignRHS(stmt));
@@ -8728,6 +9405,33 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
       WriteScalarToLHS(lhs, OutputCallRHS(stmt, 0));
     }
 
+    /// isUnreachableBlock - Return whether the given basic block does nothing
+    /// but call __builtin_unreachable.
+    static bool isUnreachableBlock(basic_block bb) {
+      if (!gimple_seq_empty_p(phi_nodes(bb)))
+        return false;
+      for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+           gsi_next(&gsi)) {
+        gimple stmt = gsi_stmt(gsi);
+        if (gimple_code(stmt) == GIMPLE_LABEL || is_gimple_debug(stmt))
+          continue;
+        if (gimple_code(stmt) != GIMPLE_CALL)
+          return false;
+        tree fndecl = gimple_call_fndecl(stmt);
+        return fndecl && DECL_BUILT_IN_CLASS(fndecl) == BUILT_IN_NORMAL &&
+               DECL_FUNCTION_CODE(fndecl) == BUILT_IN_UNREACHABLE;
+      }
+      return false;
+    }
+
+    /// isNoReturnBlock - Return whether the given basic block ends with a call
+    /// to a function that does not return, such as abort.
+    static bool isNoReturnBlock(basic_block bb) {
+      gimple stmt = last_stmt(bb);
+      return stmt && gimple_code(stmt) == GIMPLE_CALL &&
+             (gimple_call_flags(stmt) & ECF_NORETURN);
+    }
+
     void TreeToLLVM::RenderGIMPLE_COND(gimple stmt) {
       // Emit the comparison.
       Value *Cond = EmitCompare(gimple_cond_lhs(stmt), gimple_cond_rhs(stmt),
@@ -8740,8 +9444,40 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
       BasicBlock *IfTrue = getBasicBlock(true_edge->dest);
       BasicBlock *IfFalse = getBasicBlock(false_edge->dest);
 
+      if (optimize) {
+        // If one of the destinations is unreachable, as in
+        //   if (!cond) __builtin_unreachable();
+        // then the condition is known to take the other value.  Tell the
+        // optimizers this using an assumption, since the branch itself is
+        // removed as soon as the CFG is simplified.
+        bool TrueUnreachable = isUnreachableBlock(true_edge->dest);
+        bool FalseUnreachable = isUnreachableBlock(false_edge->dest);
+        if (TrueUnreachable != FalseUnreachable) {
+          Value *Assumed = TrueUnreachable ? Builder.CreateNot(Cond) : Cond;
+          Builder.CreateCall(Intrinsic::getDeclaration(TheModule,
+                                                       Intrinsic::assume),
+                             Assumed);
+          Builder.CreateBr(TrueUnreachable ? IfFalse : IfTrue);
+          return;
+        }
+      }
+
       // Branch based on the condition.
-      Builder.CreateCondBr(Cond, IfTrue, IfFalse);
+      BranchInst *Br = Builder.CreateCondBr(Cond, IfTrue, IfFalse);
+
+      // Branches to code that does not return, like a call to abort, are very
+      // unlikely to be taken.  These weights are the ones LLVM uses for paths
+      // that end in unreachable.
+      bool TrueNoReturn = isNoReturnBlock(true_edge->dest);
+      bool FalseNoReturn = isNoReturnBlock(false_edge->dest);
+      if (TrueNoReturn != FalseNoReturn) {
+        const uint32_t Unlikely = 1, Likely = 1024 * 1024 - 1;
+        MDBuilder MDHelper(Context);
+        Br->setMetadata(LLVMContext::MD_prof,
+                        TrueNoReturn
+                            ? MDHelper.createBranchWeights(Unlikely, Likely)
+                            : MDHelper.createBranchWeights(Likely, Unlikely));
+      }
     }
 
     void TreeToLLVM::RenderGIMPLE_EH_DISPATCH(gimple stmt) {
@@ -8985,12 +9721,565 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
       }
     }
 
+    //===----------------------------------------------------------------------===//
+    //                        ... Idiom Recognition ...
+    //===----------------------------------------------------------------------===//
+
+    // When the GCC optimizers are not run, open coded bit manipulation reaches us
+    // as a sequence of elementary GIMPLE assignments.  The routines below walk
+    // back through the SSA definitions feeding an assignment looking for a few
+    // well known idioms (rotates, byte swaps, parallel bit counts and de Bruijn
+    // count-trailing-zeros tables).  If one is found then the whole computation is
+    // emitted directly as the equivalent intrinsic.  The intermediate assignments
+    // are still converted as usual; the optimizers delete them if they are dead.
+
+    /// MaxIdiomDepth - The maximum number of SSA definitions to look back through
+    /// when trying to recognize an idiom.
+    static const unsigned MaxIdiomDepth = 12;
+
+    /// getDefiningAssign - If the given operand is an SSA name defined by an
+    /// assignment then return the assignment, otherwise return null.
+    static gimple getDefiningAssign(tree op) {
+      if (!isa<SSA_NAME>(op) || SSA_NAME_IS_DEFAULT_DEF(op))
+        return 0;
+      gimple def = SSA_NAME_DEF_STMT(op);
+      return is_gimple_assign(def) ? def : 0;
+    }
+
+    /// matchAssign - If the given operand is an SSA name defined by an assignment
+    /// with the given code then return true and set RHS1 and RHS2 to the operands
+    /// of the assignment (RHS2 is null for unary operations).
+    static bool matchAssign(tree op, tree_code code, tree &RHS1, tree &RHS2) {
+      gimple def = getDefiningAssign(op);
+      if (!def || gimple_assign_rhs_code(def) != code)
+        return false;
+      RHS1 = gimple_assign_rhs1(def);
+      RHS2 = gimple_assign_rhs2(def);
+      return true;
+    }
+
+    /// isIntegerConstant - Return true if the given operand is an integer constant
+    /// equal to Val.
+    static bool isIntegerConstant(tree op, uint64_t Val) {
+      return isa<INTEGER_CST>(op) && isInt64(op, true) &&
+             getInt64(op, true) == Val;
+    }
+
+    /// LookThroughConversions - Look through any integer conversions that do not
+    /// change the value of the original operand, i.e. conversions that preserve
+    /// the precision or that zero extend.
+    static tree LookThroughConversions(tree op) {
+      while (gimple def = getDefiningAssign(op)) {
+        if (!CONVERT_EXPR_CODE_P(gimple_assign_rhs_code(def)))
+          break;
+        tree src = gimple_assign_rhs1(def);
+        if (!isa<INTEGRAL_TYPE>(TREE_TYPE(src)) ||
+            !isa<INTEGRAL_TYPE>(TREE_TYPE(op)))
+          break;
+        unsigned SrcBits = TYPE_PRECISION(TREE_TYPE(src));
+        unsigned DstBits = TYPE_PRECISION(TREE_TYPE(op));
+        if (SrcBits > DstBits ||
+            (SrcBits < DstBits && !TYPE_UNSIGNED(TREE_TYPE(src))))
+          break;
+        op = src;
+      }
+      return op;
+    }
+
+    /// matchMaskedBy - If the given operand is "Val & Mask", where Mask is the
+    /// constant obtained by repeating the byte Pattern, then return Val.
+    /// Otherwise return null.
+    static tree matchMaskedBy(tree op, unsigned char Pattern) {
+      tree Val, Mask;
+      if (!matchAssign(op, BIT_AND_EXPR, Val, Mask))
+        return NULL_TREE;
+      if (isa<INTEGER_CST>(Val))
+        std::swap(Val, Mask);
+      unsigned Bits = TYPE_PRECISION(TREE_TYPE(op));
+      if (!isa<INTEGER_CST>(Mask) || Bits % 8)
+        return NULL_TREE;
+      if (getAPIntValue(Mask, Bits) != APInt::getSplat(Bits, APInt(8, Pattern)))
+        return NULL_TREE;
+      return Val;
+    }
+
+    /// isShiftOf - Return true if the given operand is Val shifted right by the
+    /// constant Amt.
+    static bool isShiftOf(tree op, tree Val, unsigned Amt) {
+      tree LHS, RHS;
+      return matchAssign(op, RSHIFT_EXPR, LHS, RHS) && LHS == Val &&
+             isIntegerConstant(RHS, Amt);
+    }
+
+    /// isComplementaryAmount - Return true if the shift amount Amt is equal to
+    /// Bits - Other, written as "Bits - Other" or, if AllowMasked is true, as
+    /// "-Other & (Bits - 1)".
+    static bool isComplementaryAmount(tree Amt, tree Other, unsigned Bits,
+                                      bool AllowMasked) {
+      Amt = LookThroughConversions(Amt);
+      Other = LookThroughConversions(Other);
+      tree A, B;
+      if (matchAssign(Amt, MINUS_EXPR, A, B))
+        return isIntegerConstant(A, Bits) && LookThroughConversions(B) == Other;
+      if (!AllowMasked || !isPowerOf2_32(Bits) ||
+          !matchAssign(Amt, BIT_AND_EXPR, A, B) ||
+          !isIntegerConstant(B, Bits - 1))
+        return false;
+      A = LookThroughConversions(A);
+      tree C, D;
+      if (matchAssign(A, NEGATE_EXPR, C, D))
+        return LookThroughConversions(C) == Other;
+      if (matchAssign(A, MINUS_EXPR, C, D))
+        return (isIntegerConstant(C, 0) || isIntegerConstant(C, Bits)) &&
+               LookThroughConversions(D) == Other;
+      return false;
+    }
+
+    /// matchRotate - Recognize "(x << n) | (x >> (Bits - n))", where the two
+    /// shifts may also be combined using '^' or '+'.  When they are combined
+    /// using '|' the complementary shift amount may also be written as
+    /// "-n & (Bits - 1)"; this is not a rotate for '^' and '+', since if n is
+    /// zero then it gives zero or 2x rather than x.  On success returns true,
+    /// setting Src to x and Amt to the rotate amount.
+    static bool matchRotate(tree_code code, tree op0, tree op1, unsigned Bits,
+                            tree &Src, tree &Amt, bool &isLeftRotate) {
+      tree X0, N0, X1, N1;
+      if (!matchAssign(op0, LSHIFT_EXPR, X0, N0))
+        std::swap(op0, op1);
+      if (!matchAssign(op0, LSHIFT_EXPR, X0, N0) ||
+          !matchAssign(op1, RSHIFT_EXPR, X1, N1))
+        return false;
+      // Right shifts of signed values are arithmetic, which is no good.
+      if (X0 != X1 || !TYPE_UNSIGNED(TREE_TYPE(X0)) ||
+          TYPE_PRECISION(TREE_TYPE(X0)) != Bits)
+        return false;
+      Src = X0;
+
+      if (isa<INTEGER_CST>(N0) && isa<INTEGER_CST>(N1)) {
+        if (!isInt64(N0, true) || !isInt64(N1, true))
+          return false;
+        uint64_t Left = getInt64(N0, true), Right = getInt64(N1, true);
+        if (!Left || Left >= Bits || Left + Right != Bits)
+          return false;
+        Amt = N0;
+        isLeftRotate = true;
+        return true;
+      }
+
+      bool AllowMasked = code == BIT_IOR_EXPR;
+      if (isComplementaryAmount(N1, N0, Bits, AllowMasked)) {
+        Amt = N0;
+        isLeftRotate = true;
+        return true;
+      }
+      if (isComplementaryAmount(N0, N1, Bits, AllowMasked)) {
+        Amt = N1;
+        isLeftRotate = false;
+        return true;
+      }
+      return false;
+    }
+
+    /// ByteMap - For each byte of an integer value, starting from the least
+    /// significant, the number of the byte of the source value that it holds.
+    /// Bytes of the source are numbered from 1; 0 means the byte is zero.
+    typedef SmallVector<unsigned char, 8> ByteMap;
+
+    static bool TraceAssignBytes(gimple def, tree &Src, ByteMap &Bytes,
+                                 unsigned Depth);
+
+    /// TraceBytes - Work out where each byte of the given integer operand comes
+    /// from in terms of the bytes of a single source value Src.  Returns false if
+    /// some byte is not a byte of Src and is not known to be zero.
+    static bool TraceBytes(tree op, tree &Src, ByteMap &Bytes, unsigned Depth) {
+      tree type = TREE_TYPE(op);
+      if (!isa<INTEGRAL_TYPE>(type) || TYPE_PRECISION(type) % 8 ||
+          TYPE_PRECISION(type) > 64)
+        return false;
+      gimple def = Depth < MaxIdiomDepth ? getDefiningAssign(op) : 0;
+      tree SavedSrc = Src;
+      if (def && TraceAssignBytes(def, Src, Bytes, Depth + 1))
+        return true;
+      // Otherwise treat the operand as being the source value.  A failed
+      // attempt to trace through its definition may have changed Src.
+      Src = SavedSrc;
+      if (!isa<SSA_NAME>(op) || (Src && Src != op))
+        return false;
+      Src = op;
+      Bytes.clear();
+      for (unsigned i = 0, e = TYPE_PRECISION(type) / 8; i != e; ++i)
+        Bytes.push_back(i + 1);
+      return true;
+    }
+
+    /// TraceAssignBytes - Helper for TraceBytes that works out where the bytes of
+    /// the value computed by the given assignment come from.
+    static bool TraceAssignBytes(gimple def, tree &Src, ByteMap &Bytes,
+                                 unsigned Depth) {
+      tree type = TREE_TYPE(gimple_assign_lhs(def));
+      if (!isa<INTEGRAL_TYPE>(type) || TYPE_PRECISION(type) % 8 ||
+          TYPE_PRECISION(type) > 64)
+        return false;
+      unsigned NumBytes = TYPE_PRECISION(type) / 8;
+      tree rhs1 = gimple_assign_rhs1(def);
+      tree rhs2 = gimple_assign_rhs2(def);
+      tree_code code = gimple_assign_rhs_code(def);
+
+      switch (code) {
+      default:
+        return false;
+
+      case CONVERT_EXPR:
+      case NOP_EXPR:
+        // Truncation drops the high bytes, zero extension adds zero bytes.
+        if (!TraceBytes(rhs1, Src, Bytes, Depth))
+          return false;
+        if (Bytes.size() < NumBytes && !TYPE_UNSIGNED(TREE_TYPE(rhs1)))
+          return false;
+        Bytes.resize(NumBytes, 0);
+        return true;
+
+      case LROTATE_EXPR:
+      case LSHIFT_EXPR:
+      case RROTATE_EXPR:
+      case RSHIFT_EXPR: {
+        if (!isa<INTEGER_CST>(rhs2) || !isInt64(rhs2, true))
+          return false;
+        uint64_t Amt = getInt64(rhs2, true);
+        if (Amt % 8 || Amt >= NumBytes * 8)
+          return false;
+        if (code == RSHIFT_EXPR && !TYPE_UNSIGNED(type))
+          return false;
+        if (!TraceBytes(rhs1, Src, Bytes, Depth) || Bytes.size() != NumBytes)
+          return false;
+        unsigned Shift = Amt / 8;
+        ByteMap In(Bytes);
+        for (unsigned i = 0; i != NumBytes; ++i)
+          switch (code) {
+          default:
+            llvm_unreachable("Unexpected shift!");
+          case LROTATE_EXPR:
+            Bytes[i] = In[(i + NumBytes - Shift) % NumBytes];
+            break;
+          case LSHIFT_EXPR:
+            Bytes[i] = i < Shift ? 0 : In[i - Shift];
+            break;
+          case RROTATE_EXPR:
+            Bytes[i] = In[(i + Shift) % NumBytes];
+            break;
+          case RSHIFT_EXPR:
+            Bytes[i] = i + Shift < NumBytes ? In[i + Shift] : 0;
+            break;
+          }
+        return true;
+      }
+
+      case BIT_AND_EXPR: {
+        // Masking out whole bytes.
+        if (!isa<INTEGER_CST>(rhs2))
+          return false;
+        APInt Mask = getAPIntValue(rhs2, NumBytes * 8);
+        if (!TraceBytes(rhs1, Src, Bytes, Depth) || Bytes.size() != NumBytes)
+          return false;
+        for (unsigned i = 0; i != NumBytes; ++i) {
+          uint64_t MaskByte = Mask.lshr(i * 8).getLoBits(8).getZExtValue();
+          if (MaskByte == 0)
+            Bytes[i] = 0;
+          else if (MaskByte != 0xFF)
+            return false;
+        }
+        return true;
+      }
+
+      case BIT_IOR_EXPR:
+      case BIT_XOR_EXPR:
+      case PLUS_EXPR: {
+        // Combining values that have no non-zero bytes in common.
+        ByteMap Other;
+        if (!TraceBytes(rhs1, Src, Bytes, Depth) ||
+            !TraceBytes(rhs2, Src, Other, Depth) || Bytes.size() != NumBytes ||
+            Other.size() != NumBytes)
+          return false;
+        for (unsigned i = 0; i != NumBytes; ++i) {
+          if (Bytes[i] && Other[i])
+            return false;
+          Bytes[i] |= Other[i];
+        }
+        return true;
+      }
+      }
+    }
+
+    /// matchByteSwap - If the given assignment computes a byte swap of some value
+    /// then return that value, otherwise return null.
+    static tree matchByteSwap(gimple stmt) {
+      tree type = TREE_TYPE(gimple_assign_lhs(stmt));
+      unsigned Bits = TYPE_PRECISION(type);
+      if (Bits != 16 && Bits != 32 && Bits != 64)
+        return NULL_TREE;
+      tree Src = NULL_TREE;
+      ByteMap Bytes;
+      if (!TraceAssignBytes(stmt, Src, Bytes, 0) || !Src ||
+          TYPE_PRECISION(TREE_TYPE(Src)) != Bits)
+        return NULL_TREE;
+      unsigned NumBytes = Bits / 8;
+      for (unsigned i = 0; i != NumBytes; ++i)
+        if (Bytes[i] != NumBytes - i)
+          return NULL_TREE;
+      return Src;
+    }
+
+    /// matchPopCount - Recognize the classic parallel bit count
+    ///   x = x - ((x >> 1) & 0x55...55);
+    ///   x = (x & 0x33...33) + ((x >> 2) & 0x33...33);
+    ///   x = (x + (x >> 4)) & 0x0f...0f;
+    ///   return (x * 0x01...01) >> (Bits - 8);
+    /// given the operands of the final right shift.  Returns the original value
+    /// of x if matched, otherwise null.
+    static tree matchPopCount(tree op0, tree op1, unsigned Bits) {
+      if (Bits % 8 || !isIntegerConstant(op1, Bits - 8) ||
+          !TYPE_UNSIGNED(TREE_TYPE(op0)))
+        return NULL_TREE;
+
+      // (x * 0x01...01)
+      tree Sum, Ones;
+      if (!matchAssign(op0, MULT_EXPR, Sum, Ones))
+        return NULL_TREE;
+      if (isa<INTEGER_CST>(Sum))
+        std::swap(Sum, Ones);
+      if (!isa<INTEGER_CST>(Ones) ||
+          getAPIntValue(Ones, Bits) != APInt::getSplat(Bits, APInt(8, 1)))
+        return NULL_TREE;
+
+      // (x + (x >> 4)) & 0x0f...0f
+      tree Nibbles = matchMaskedBy(Sum, 0x0F);
+      tree A, B;
+      if (!Nibbles || !matchAssign(Nibbles, PLUS_EXPR, A, B))
+        return NULL_TREE;
+      if (!isShiftOf(B, A, 4)) {
+        std::swap(A, B);
+        if (!isShiftOf(B, A, 4))
+          return NULL_TREE;
+      }
+      tree Pairs = A;
+
+      // (x & 0x33...33) + ((x >> 2) & 0x33...33)
+      if (!matchAssign(Pairs, PLUS_EXPR, A, B))
+        return NULL_TREE;
+      A = matchMaskedBy(A, 0x33);
+      B = matchMaskedBy(B, 0x33);
+      if (!A || !B)
+        return NULL_TREE;
+      if (!isShiftOf(B, A, 2)) {
+        std::swap(A, B);
+        if (!isShiftOf(B, A, 2))
+          return NULL_TREE;
+      }
+
+      // x - ((x >> 1) & 0x55...55)
+      tree X, Odd;
+      if (!matchAssign(A, MINUS_EXPR, X, Odd))
+        return NULL_TREE;
+      Odd = matchMaskedBy(Odd, 0x55);
+      if (!Odd || !isShiftOf(Odd, X, 1) || TYPE_PRECISION(TREE_TYPE(X)) != Bits)
+        return NULL_TREE;
+      return X;
+    }
+
+    /// matchDeBruijnCTZ - Recognize a count of trailing zeros computed by looking
+    /// up a de Bruijn table: "Table[((x & -x) * Magic) >> (Bits - log2(Bits))]".
+    /// If matched, returns x and sets ZeroVal to the table entry obtained when x
+    /// is zero.  Otherwise returns null.
+    static tree matchDeBruijnCTZ(tree ref, APInt &ZeroVal) {
+      tree base = TREE_OPERAND(ref, 0);
+      tree elt_type = TREE_TYPE(ref);
+      if (!isa<VAR_DECL>(base) || !TREE_READONLY(base) ||
+          TREE_THIS_VOLATILE(base) || !TREE_STATIC(base) ||
+          !DECL_INITIAL(base) || !isa<CONSTRUCTOR>(DECL_INITIAL(base)) ||
+          !isa<INTEGRAL_TYPE>(elt_type) ||
+          !integer_zerop(array_ref_low_bound(ref)))
+        return NULL_TREE;
+
+      // ((x & -x) * Magic) >> Shift
+      tree Product, Shift;
+      if (!matchAssign(LookThroughConversions(TREE_OPERAND(ref, 1)),
+                       RSHIFT_EXPR, Product, Shift))
+        return NULL_TREE;
+      unsigned Bits = TYPE_PRECISION(TREE_TYPE(Product));
+      if ((Bits != 32 && Bits != 64) || !TYPE_UNSIGNED(TREE_TYPE(Product)) ||
+          !isIntegerConstant(Shift, Bits - Log2_32(Bits)))
+        return NULL_TREE;
+      tree LowBit, Magic;
+      if (!matchAssign(Product, MULT_EXPR, LowBit, Magic))
+        return NULL_TREE;
+      if (isa<INTEGER_CST>(LowBit))
+        std::swap(LowBit, Magic);
+      tree X, NegX, Negated, Unused;
+      if (!isa<INTEGER_CST>(Magic) ||
+          !matchAssign(LowBit, BIT_AND_EXPR, X, NegX))
+        return NULL_TREE;
+      if (!matchAssign(NegX, NEGATE_EXPR, Negated, Unused) || Negated != X) {
+        std::swap(X, NegX);
+        if (!matchAssign(NegX, NEGATE_EXPR, Negated, Unused) || Negated != X)
+          return NULL_TREE;
+      }
+      if (TYPE_PRECISION(TREE_TYPE(X)) != Bits)
+        return NULL_TREE;
+
+      // The table needs to have an entry for every possible index.
+      HOST_WIDE_INT TableSize = int_size_in_bytes(TREE_TYPE(base));
+      HOST_WIDE_INT EltSize = int_size_in_bytes(elt_type);
+      if (TableSize <= 0 || EltSize <= 0 || TableSize / EltSize < Bits)
+        return NULL_TREE;
+
+      // Read out the table contents.  Missing entries are zero.
+      SmallVector<APInt, 64> Table(Bits, APInt(64, 0));
+      unsigned HOST_WIDE_INT ix;
+      tree index, value;
+      uint64_t Pos = 0;
+      FOR_EACH_CONSTRUCTOR_ELT(CONSTRUCTOR_ELTS(DECL_INITIAL(base)), ix, index,
+                               value) {
+        if (index) {
+          if (!isa<INTEGER_CST>(index) || !isInt64(index, true))
+            return NULL_TREE;
+          Pos = getInt64(index, true);
+        }
+        if (Pos >= Bits)
+          break;
+        if (!isa<INTEGER_CST>(value))
+          return NULL_TREE;
+        Table[Pos++] = getAPIntValue(value, 64);
+      }
+
+      // Check that the table maps each power of two to its logarithm.
+      APInt MagicVal = getAPIntValue(Magic, Bits);
+      for (unsigned i = 0; i != Bits; ++i) {
+        uint64_t Slot = (APInt::getOneBitSet(Bits, i) * MagicVal)
+                            .lshr(Bits - Log2_32(Bits)).getZExtValue();
+        if (Table[Slot] != i)
+          return NULL_TREE;
+      }
+
+      ZeroVal = Table[0];
+      return X;
+    }
+
+    /// EmitRotate - Rotate In left (or right) by Amt bits.  When the width is a
+    /// power of two the rotate is written as "(In << (Amt & (Bits - 1))) |
+    /// (In >> (-Amt & (Bits - 1)))", which is defined for every amount and which
+    /// the code generators turn into a single rotate instruction.
+    Value *TreeToLLVM::EmitRotate(Value * In, Value * Amt, bool isLeftRotate) {
+      Type *Ty = In->getType();
+      unsigned Bits = Ty->getPrimitiveSizeInBits();
+      if (Amt->getType() != Ty)
+        Amt = Builder.CreateIntCast(Amt, Ty, /*isSigned*/ false,
+                                    Amt->getName() + ".cast");
+
+      Value *Amt1, *Amt2;
+      if (isPowerOf2_32(Bits)) {
+        Constant *Mask = ConstantInt::get(Ty, Bits - 1);
+        Amt1 = Builder.CreateAnd(Amt, Mask);
+        Amt2 = Builder.CreateAnd(Builder.CreateNeg(Amt), Mask);
+      } else {
+        Amt1 = Amt;
+        Amt2 = Builder.CreateSub(ConstantInt::get(Ty, Bits), Amt);
+      }
+
+      // Do the two shifts and or them together.
+      Value *V1 = isLeftRotate ? Builder.CreateShl(In, Amt1)
+                               : Builder.CreateLShr(In, Amt1);
+      Value *V2 = isLeftRotate ? Builder.CreateLShr(In, Amt2)
+                               : Builder.CreateShl(In, Amt2);
+      return Builder.CreateOr(V1, V2);
+    }
+
+    /// EmitRecognizedIdiom - If the right-hand side of the given assignment is
+    /// the final step of a recognized bit manipulation idiom then emit the whole
+    /// computation using the corresponding intrinsic and return the result.
+    /// Otherwise return null.
+    Value *TreeToLLVM::EmitRecognizedIdiom(gimple stmt) {
+      tree type = TREE_TYPE(gimple_assign_lhs(stmt));
+      if (!isa<INTEGRAL_TYPE>(type))
+        return 0;
+      unsigned Bits = TYPE_PRECISION(type);
+      tree rhs1 = gimple_assign_rhs1(stmt);
+      tree rhs2 = gimple_assign_rhs2(stmt);
+      tree_code code = gimple_assign_rhs_code(stmt);
+
+      Value *Result = 0;
+      switch (code) {
+      default:
+        break;
+
+      case ARRAY_REF: {
+        APInt ZeroVal;
+        tree Src = matchDeBruijnCTZ(rhs1, ZeroVal);
+        if (!Src)
+          break;
+        Value *X = EmitRegister(Src);
+        Value *CTZ = Builder.CreateCall2(
+            Intrinsic::getDeclaration(TheModule, Intrinsic::cttz, X->getType()),
+            X, Builder.getTrue());
+        Type *EltTy = getRegType(TREE_TYPE(rhs1));
+        CTZ = Builder.CreateIntCast(CTZ, EltTy, /*isSigned*/ false);
+        // The table lookup gives the first table entry if x is zero.
+        Value *IsZero =
+            Builder.CreateICmpEQ(X, Constant::getNullValue(X->getType()));
+        Constant *Zero = ConstantInt::get(
+            EltTy, ZeroVal.zextOrTrunc(EltTy->getPrimitiveSizeInBits()));
+        Result = Builder.CreateSelect(IsZero, Zero, CTZ);
+        break;
+      }
+
+      case BIT_IOR_EXPR:
+      case BIT_XOR_EXPR:
+      case PLUS_EXPR: {
+        tree Src, Amt;
+        bool isLeftRotate;
+        if (matchRotate(code, rhs1, rhs2, Bits, Src, Amt, isLeftRotate)) {
+          Result =
+              EmitRotate(EmitRegister(Src), EmitRegister(Amt), isLeftRotate);
+          break;
+        }
+      }
+      // FALL THROUGH
+      case LROTATE_EXPR:
+      case RROTATE_EXPR:
+        if (tree Src = matchByteSwap(stmt)) {
+          Value *X = EmitRegister(Src);
+          Result = Builder.CreateCall(
+              Intrinsic::getDeclaration(TheModule, Intrinsic::bswap,
+                                        X->getType()), X);
+        }
+        break;
+
+      case RSHIFT_EXPR:
+        if (tree Src = matchPopCount(rhs1, rhs2, Bits)) {
+          Value *X = EmitRegister(Src);
+          Result = Builder.CreateCall(
+              Intrinsic::getDeclaration(TheModule, Intrinsic::ctpop,
+                                        X->getType()), X);
+        }
+        break;
+      }
+
+      if (Result)
+        ++NumIdiomsRecognized;
+      return Result;
+    }
+
     //===----------------------------------------------------------------------===//
     //                          ... Render helpers ...
     //===----------------------------------------------------------------------===//
 
     /// EmitAssignRHS - Convert the RHS of a scalar GIMPLE_ASSIGN to LLVM.
     Value *TreeToLLVM::EmitAssignRHS(gimple stmt) {
+      // If this assignment completes a bit manipulation idiom then emit it as
+      // the corresponding intrinsic.
+      if (optimize)
+        if (Value *RHS = EmitRecognizedIdiom(stmt))
+          return RHS;
+
       // Loads from memory and other non-register expressions are handled by
       // EmitAssignSingleRHS.
       if (get_gimple_rhs_class(gimple_expr_code(stmt)) == GIMPLE_SINGLE_RHS) {
@@ -9088,8 +10377,7 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
         RHS = EmitReg_FLOOR_MOD_EXPR(rhs1, rhs2);
         break;
       case LROTATE_EXPR:
-        RHS = EmitReg_RotateOp(type, rhs1, rhs2, Instruction::Shl,
-                               Instruction::LShr);
+        RHS = EmitReg_RotateOp(type, rhs1, rhs2, /*isLeftRotate*/ true);
         break;
       case LSHIFT_EXPR:
         RHS = EmitReg_ShiftOp(rhs1, rhs2, Instruction::Shl);
@@ -9132,8 +10420,7 @@ bool TreeToLLVM::EmitBuiltinCall(gimple stmt, tree fndecl,
         RHS = EmitReg_ROUND_DIV_EXPR(rhs1, rhs2);
         break;
       case RROTATE_EXPR:
-        RHS = EmitReg_RotateOp(type, rhs1, rhs2, Instruction::LShr,
-                               Instruction::Shl);
+        RHS = EmitReg_RotateOp(type, rhs1, rhs2, /*isLeftRotate*/ false);
         break;
       case RSHIFT_EXPR:
         RHS = EmitReg_ShiftOp(rhs1, rhs2,
@@ -205,6 +205,35 @@ static StringRef getLinkageName(tree Node) {
   return StringRef();
 }
 
+/// getTypeIdentifier - Return a name for the given record type that is the same
+/// in every translation unit that defines it, or the empty string if there is
+/// no such name.  Types with an identifier are put in DWARF type units, which
+/// the linker can deduplicate.  The name is that of the type's typeinfo name
+/// string, just like for clang.
+static std::string getTypeIdentifier(tree type) {
+#if (GCC_MINOR > 6)
+  if (!flag_debug_types_section)
+    return std::string();
+
+  // Only C++ has a one-definition-rule for types and a way of mangling them.
+  const std::string LanguageName(lang_hooks.name);
+  if (LanguageName != "GNU C++" && LanguageName != "GNU Objective-C++")
+    return std::string();
+
+  // Types in anonymous namespaces and local to a function may have the same
+  // mangled name as different types in other translation units.
+  tree Name = TYPE_NAME(type);
+  if (!Name || !isa<TYPE_DECL>(Name) || !TREE_PUBLIC(Name) ||
+      decl_function_context(Name))
+    return std::string();
+
+  return std::string("_ZTS") + IDENTIFIER_POINTER(DECL_ASSEMBLER_NAME(Name));
+#else
+  (void)type;
+  return std::string();
+#endif
+}
+
 DebugInfo::DebugInfo(Module *m)
     : M(*m), VMContext(M.getContext()), Builder(M), DeclareFn(0),
     ValueFn(0), CurFullPath(""), PrevFullPath(""), CurLineNo(0), PrevLineNo(0),
@@ -689,9 +718,13 @@ DIType DebugInfo::createStructType(tree type) {
         return DIType(TN);
   }
 
+  // With -fdebug-types-section, types obeying the one-definition-rule are given
+  // an identifier, which causes the code generator to emit them in type units.
+  std::string Identifier = getTypeIdentifier(type);
+
   llvm::DIType FwdDecl = Builder.createReplaceableForwardDecl(
       Tag, GetNodeName(type), TyContext, getOrCreateFile(Loc.file), Loc.line,
-      0, 0, 0);
+      0, 0, 0, Identifier);
 
   if (TYPE_SIZE(type) == 0)
     // forward declaration,
@@ -837,7 +870,7 @@ DIType DebugInfo::createStructType(tree type) {
       Tag, findRegion(TYPE_CONTEXT(type)), GetNodeName(type),
       getOrCreateFile(Loc.file), Loc.line, NodeSizeInBits(type),
       NodeAlignInBits(type), 0, SFlags, llvm::DIType(), Elements, RunTimeLang,
-      ContainingType);
+      ContainingType, Identifier);
   RegionMap[type] = WeakVH(RealDecl);
 
   // Now that we have a real decl for the struct, replace anything using the
@@ -1033,8 +1066,18 @@ void DebugInfo::getOrCreateCompileUnit(const char *FullPath, bool isMain) {
   unsigned ObjcRunTimeVer = 0;
   //  if (flag_objc_abi != 0 && flag_objc_abi != -1)
   //    ObjcRunTimeVer = flag_objc_abi;
+
+  // With -gsplit-dwarf most of the debug info goes in .dwo sections, which the
+  // GCC driver moves into a file of its own using objcopy.  The skeleton unit
+  // left in the object names that file, so use the same name as GCC does.
+  std::string SplitName;
+#if (GCC_MINOR > 7)
+  if (dwarf_split_debug_info && aux_base_name)
+    SplitName = std::string(aux_base_name) + ".dwo";
+#endif
+
   Builder.createCompileUnit(LangTag, FileName, Directory, version_string,
-                            optimize, Flags, ObjcRunTimeVer);
+                            optimize, Flags, ObjcRunTimeVer, SplitName);
 }
 
 /// getOrCreateFile - Get DIFile descriptor.
@@ -1095,7 +1138,8 @@ DICompositeType DebugInfo::CreateCompositeType(
     unsigned Tag, DIDescriptor Context, StringRef Name, DIFile F,
     unsigned LineNumber, uint64_t SizeInBits, uint64_t AlignInBits,
     uint64_t OffsetInBits, unsigned Flags, DIType DerivedFrom, DIArray Elements,
-    unsigned RuntimeLang, MDNode *ContainingType) {
+    unsigned RuntimeLang, MDNode *ContainingType,
+    StringRef UniqueIdentifier) {
   switch (Tag) {
   case dwarf::DW_TAG_array_type:
     return Builder.createArrayType(SizeInBits, AlignInBits, DerivedFrom,
@@ -1103,10 +1147,12 @@ DICompositeType DebugInfo::CreateCompositeType(
   case dwarf::DW_TAG_structure_type:
     return Builder.createStructType(Context, Name, F, LineNumber, SizeInBits,
                                     AlignInBits, Flags, DerivedFrom, Elements,
-                                    0, DIType(ContainingType));
+                                    0, DIType(ContainingType),
+                                    UniqueIdentifier);
   case dwarf::DW_TAG_union_type:
     return Builder.createUnionType(Context, Name, F, LineNumber, SizeInBits,
-                                   AlignInBits, Flags, Elements, RuntimeLang);
+                                   AlignInBits, Flags, Elements, RuntimeLang,
+                                   UniqueIdentifier);
   case dwarf::DW_TAG_enumeration_type:
     return Builder.createEnumerationType(Context, Name, F, LineNumber,
                                          SizeInBits, AlignInBits, Elements,
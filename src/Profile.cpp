@@ -0,0 +1,671 @@
+//===------ Profile.cpp - Profile instrumentation and feedback -----------===//
+//
+// Copyright (C) 2013  Duncan Sands et al.
+//
+// This file is part of DragonEgg.
+//
+// DragonEgg is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2, or (at your option) any later version.
+//
+// DragonEgg is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// DragonEgg; see the file COPYING.  If not, write to the Free Software
+// Foundation, 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+//
+//===----------------------------------------------------------------------===//
+// This file implements profiling: instrumenting code to count how often each
+// branch is taken and which functions indirect calls call, and reading the
+// resulting profiles back in.  The profiles are described in Profile.h.
+//===----------------------------------------------------------------------===//
+
+// Plugin headers
+#include "dragonegg/Internals.h"
+#include "dragonegg/Profile.h"
+
+// LLVM headers
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/PassManager.h"
+#include "llvm/ProfileData/InstrProfReader.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Instrumentation.h"
+
+// System headers
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+static LLVMContext &Context = getGlobalContext();
+
+const char *ICallProfileGenerateFile = 0;
+const char *ICallProfileUseFile = 0;
+
+/// ICallProfileMagic, ICallProfileVersion - Identify an indirect call profile.
+static const uint32_t ICallProfileMagic = 0x44454943; // 'DEIC'
+static const uint32_t ICallProfileVersion = 1;
+
+/// ICallPromotionPercent - Only call a target directly if at least this
+/// percentage of the calls made from the site go to it.
+static const uint64_t ICallPromotionPercent = 30;
+
+/// ICallPromotionMinCount - Only call a target directly if it was called at
+/// least this many times from the site.
+static const uint64_t ICallPromotionMinCount = 100;
+
+/// MaxPromotedTargets - The maximum number of targets to call directly from any
+/// one call site.
+static const unsigned MaxPromotedTargets = 2;
+
+//===----------------------------------------------------------------------===//
+//                                ... Names ...
+//===----------------------------------------------------------------------===//
+
+/// getProfileHash - Return the low 64 bits of the MD5 of the given string.
+static uint64_t getProfileHash(StringRef Str) {
+  MD5 Hash;
+  Hash.update(Str);
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  uint64_t Low = 0;
+  for (unsigned i = 0; i != 8; ++i)
+    Low |= (uint64_t) Result[i] << (8 * i);
+  return Low;
+}
+
+/// getProfileName - Return the name by which a function is known in profiles.
+/// Local functions are qualified by the name of the source file to make them
+/// unique.
+static std::string getProfileName(const Function *F) {
+  if (!F->hasLocalLinkage())
+    return F->getName();
+  return TheModule->getModuleIdentifier() + ":" + F->getName().str();
+}
+
+uint64_t getIndirectCallSiteID(Function *F) {
+  static const Function *CurrentFunction;
+  static unsigned SiteNo;
+  if (F != CurrentFunction) {
+    CurrentFunction = F;
+    SiteNo = 0;
+  }
+  return getProfileHash(getProfileName(F) + "/" + utostr(SiteNo++));
+}
+
+//===----------------------------------------------------------------------===//
+//                             ... Edge Profiles ...
+//===----------------------------------------------------------------------===//
+
+bool ProfileGenerate = false;
+bool ProfileAtomicCounters = false;
+
+/// EdgeProfile - The edge profile being used to guide optimization, if any.
+static std::unique_ptr<IndexedInstrProfReader> EdgeProfile;
+
+/// getProfiledEdges - Get the edges of the given function that have counters,
+/// and compute a hash of the control flow graph which changes if the edges do.
+static uint64_t getProfiledEdges(Function *F,
+                                 std::vector<TerminatorInst *> &Branches) {
+  std::string Shape;
+  for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+    TerminatorInst *TI = BB->getTerminator();
+    if (!TI || TI->getNumSuccessors() < 2 ||
+        (!isa<BranchInst>(TI) && !isa<SwitchInst>(TI)))
+      continue;
+    Branches.push_back(TI);
+    Shape += utostr(TI->getNumSuccessors()) + ",";
+  }
+  return getProfileHash(Shape);
+}
+
+/// getProfileNameVar - Return the global holding the name of the given function
+/// as used by the LLVM profile runtime.
+static Constant *getProfileNameVar(Function *F) {
+  std::string Name = getProfileName(F);
+  GlobalVariable *GV = new GlobalVariable(
+      *TheModule, ArrayType::get(Type::getInt8Ty(Context), Name.size()), true,
+      GlobalValue::PrivateLinkage,
+      ConstantDataArray::getString(Context, Name, false),
+      "__llvm_profile_name_" + Name);
+  return TheFolder->CreateBitCast(GV, Type::getInt8PtrTy(Context));
+}
+
+void InstrumentEdges(Function *F) {
+  std::vector<TerminatorInst *> Branches;
+  uint64_t Hash = getProfiledEdges(F, Branches);
+  unsigned NumCounters = 1;
+  for (unsigned i = 0, e = Branches.size(); i != e; ++i)
+    NumCounters += Branches[i]->getNumSuccessors();
+
+  Function *Increment =
+      Intrinsic::getDeclaration(TheModule, Intrinsic::instrprof_increment);
+  Constant *Name = getProfileNameVar(F);
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Constant *HashVal = ConstantInt::get(Type::getInt64Ty(Context), Hash);
+  Constant *NumCountersVal = ConstantInt::get(Int32Ty, NumCounters);
+  LLVMBuilder Builder(Context, *TheFolder);
+
+  // Count the number of times the function is called.
+  Builder.SetInsertPoint(F->getEntryBlock().getFirstInsertionPt());
+  Builder.CreateCall4(Increment, Name, HashVal, NumCountersVal,
+                      ConstantInt::get(Int32Ty, 0));
+
+  // Count the number of times each edge is taken.  If the edge is the only way
+  // into its destination then the count goes in the destination, otherwise the
+  // edge is split and the count goes in the new block.
+  unsigned Counter = 1;
+  for (unsigned i = 0, e = Branches.size(); i != e; ++i) {
+    TerminatorInst *TI = Branches[i];
+    BasicBlock *BB = TI->getParent();
+    for (unsigned j = 0, je = TI->getNumSuccessors(); j != je; ++j) {
+      BasicBlock *Succ = TI->getSuccessor(j);
+      if (Succ->getSinglePredecessor() == BB) {
+        Builder.SetInsertPoint(Succ->getFirstInsertionPt());
+      } else {
+        BasicBlock *Edge =
+            BasicBlock::Create(Context, BB->getName() + ".prof", F, Succ);
+        Builder.SetInsertPoint(Edge);
+        Builder.CreateBr(Succ);
+        TI->setSuccessor(j, Edge);
+        for (BasicBlock::iterator I = Succ->begin(); isa<PHINode>(I); ++I) {
+          PHINode *PN = cast<PHINode>(I);
+          PN->setIncomingBlock(PN->getBasicBlockIndex(BB), Edge);
+        }
+        Builder.SetInsertPoint(Edge->getTerminator());
+      }
+      Builder.CreateCall4(Increment, Name, HashVal, NumCountersVal,
+                          ConstantInt::get(Int32Ty, Counter++));
+    }
+  }
+}
+
+bool LoadEdgeProfile(const char *FileName, std::string &Error) {
+  if (std::error_code EC = IndexedInstrProfReader::create(FileName,
+                                                          EdgeProfile)) {
+    Error = EC.message();
+    return false;
+  }
+  return true;
+}
+
+void ApplyEdgeProfile(Function *F) {
+  if (!EdgeProfile)
+    return;
+  std::vector<TerminatorInst *> Branches;
+  uint64_t Hash = getProfiledEdges(F, Branches);
+  std::vector<uint64_t> Counts;
+  // Functions that were changed since the profile was made are not annotated.
+  if (EdgeProfile->getFunctionCounts(getProfileName(F), Hash, Counts))
+    return;
+  unsigned NumCounters = 1;
+  for (unsigned i = 0, e = Branches.size(); i != e; ++i)
+    NumCounters += Branches[i]->getNumSuccessors();
+  if (Counts.size() != NumCounters)
+    return;
+
+  // A function that was never called in the training runs is probably cold.
+  if (!Counts[0])
+    F->addFnAttr(Attribute::Cold);
+
+  MDBuilder MDHelper(Context);
+  unsigned Counter = 1;
+  for (unsigned i = 0, e = Branches.size(); i != e; ++i) {
+    TerminatorInst *TI = Branches[i];
+    unsigned NumSuccs = TI->getNumSuccessors();
+    uint64_t Max = *std::max_element(Counts.begin() + Counter,
+                                     Counts.begin() + Counter + NumSuccs);
+    // Scale the counts so they fit in 32 bits.  Add one so that no edge ends up
+    // being considered impossible.
+    unsigned Shift = 0;
+    while ((Max >> Shift) >= ~0U)
+      ++Shift;
+    SmallVector<uint32_t, 4> Weights;
+    for (unsigned j = 0; j != NumSuccs; ++j)
+      Weights.push_back((uint32_t)(Counts[Counter++] >> Shift) + 1);
+    TI->setMetadata(LLVMContext::MD_prof,
+                    MDHelper.createBranchWeights(Weights));
+  }
+}
+
+/// MakeCountersAtomic - Turn the non-atomic counter increments produced by the
+/// profile lowering into atomic increments.
+static void MakeCountersAtomic(Constant *C) {
+  SmallVector<User *, 8> Users(C->user_begin(), C->user_end());
+  for (unsigned i = 0, e = Users.size(); i != e; ++i) {
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(Users[i])) {
+      MakeCountersAtomic(CE);
+      continue;
+    }
+    // Look for: load C; add 1; store C.
+    LoadInst *Load = dyn_cast<LoadInst>(Users[i]);
+    if (!Load || !Load->hasOneUse())
+      continue;
+    BinaryOperator *Add = dyn_cast<BinaryOperator>(Load->user_back());
+    if (!Add || Add->getOpcode() != Instruction::Add || !Add->hasOneUse())
+      continue;
+    StoreInst *Store = dyn_cast<StoreInst>(Add->user_back());
+    if (!Store || Store->getPointerOperand() != C)
+      continue;
+    Value *Step = Add->getOperand(0) == Load ? Add->getOperand(1)
+                                             : Add->getOperand(0);
+    new AtomicRMWInst(AtomicRMWInst::Add, C, Step, Monotonic, CrossThread,
+                      Store);
+    Store->eraseFromParent();
+    Add->eraseFromParent();
+    Load->eraseFromParent();
+  }
+}
+
+void FinishEdgeProfile() {
+  if (!ProfileGenerate)
+    return;
+
+  PassManager PM;
+  PM.add(new DataLayoutPass());
+  PM.add(createInstrProfilingPass(InstrProfOptions()));
+  PM.run(*TheModule);
+
+  if (ProfileAtomicCounters)
+    for (Module::global_iterator I = TheModule->global_begin(),
+         E = TheModule->global_end(); I != E; ++I)
+      if (I->getName().startswith("__llvm_profile_counters_"))
+        MakeCountersAtomic(I);
+}
+
+//===----------------------------------------------------------------------===//
+//                     ... Indirect Call Instrumentation ...
+//===----------------------------------------------------------------------===//
+
+/// SiteCounters - The counters for each instrumented call site, in the order
+/// in which the sites were instrumented.  These are placeholders which are
+/// replaced with parts of the table output by FinishIndirectCallProfile.
+static std::vector<std::pair<uint64_t, GlobalVariable *> > SiteCounters;
+
+/// getTargetEntryType - The type of the count of calls to one target.
+static StructType *getTargetEntryType() {
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  return StructType::get(Int64Ty, Int64Ty, NULL);
+}
+
+/// getSiteType - The type of the counters for one call site.
+static StructType *getSiteType() {
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  return StructType::get(
+      Int64Ty, ArrayType::get(getTargetEntryType(), ICallTargetsPerSite),
+      Int64Ty, NULL);
+}
+
+Constant *getIndirectCallCounters(uint64_t SiteID) {
+  StructType *SiteTy = getSiteType();
+  Constant *Init = ConstantStruct::get(
+      SiteTy, ConstantInt::get(Type::getInt64Ty(Context), SiteID),
+      Constant::getNullValue(SiteTy->getElementType(1)),
+      Constant::getNullValue(SiteTy->getElementType(2)), NULL);
+  GlobalVariable *GV =
+      new GlobalVariable(*TheModule, SiteTy, false,
+                         GlobalValue::InternalLinkage, Init, "icall.counters");
+  SiteCounters.push_back(std::make_pair(SiteID, GV));
+  return GV;
+}
+
+Function *getIndirectCallRecorder() {
+  static Function *Recorder;
+  if (Recorder)
+    return Recorder;
+
+  // void dragonegg.icall.record(site *Counters, i8 *Target)
+  StructType *SiteTy = getSiteType();
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  Type *ArgTys[] = { SiteTy->getPointerTo(), Type::getInt8PtrTy(Context) };
+  Recorder = Function::Create(
+      FunctionType::get(Type::getVoidTy(Context), ArgTys, false),
+      GlobalValue::InternalLinkage, "dragonegg.icall.record", TheModule);
+  Recorder->addFnAttr(Attribute::NoUnwind);
+  Function::arg_iterator AI = Recorder->arg_begin();
+  Value *Counters = AI++;
+  Value *Target = AI;
+
+  // Look through the entries for this target or an empty slot.  The counts are
+  // not updated atomically; in a multi-threaded program a few calls may be lost
+  // but the profile remains representative.
+  LLVMBuilder Builder(Context, *TheFolder);
+  Builder.SetInsertPoint(BasicBlock::Create(Context, "entry", Recorder));
+  Value *Address = Builder.CreatePtrToInt(Target, Int64Ty);
+  Constant *One = ConstantInt::get(Int64Ty, 1);
+  for (unsigned i = 0; i != ICallTargetsPerSite; ++i) {
+    Value *SlotPtr = Builder.CreateConstInBoundsGEP2_32(
+        Builder.CreateStructGEP(Counters, 1), 0, i);
+    Value *AddressPtr = Builder.CreateStructGEP(SlotPtr, 0);
+    Value *CountPtr = Builder.CreateStructGEP(SlotPtr, 1);
+    Value *SlotAddress = Builder.CreateLoad(AddressPtr);
+
+    BasicBlock *Hit = BasicBlock::Create(Context, "hit", Recorder);
+    BasicBlock *Miss = BasicBlock::Create(Context, "miss", Recorder);
+    BasicBlock *Claim = BasicBlock::Create(Context, "claim", Recorder);
+    BasicBlock *Next = BasicBlock::Create(Context, "next", Recorder);
+    Builder.CreateCondBr(Builder.CreateICmpEQ(SlotAddress, Address), Hit, Miss);
+
+    // The slot holds this target: increment its count.
+    Builder.SetInsertPoint(Hit);
+    Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(CountPtr), One),
+                        CountPtr);
+    Builder.CreateRetVoid();
+
+    // If the slot is empty then claim it for this target.
+    Builder.SetInsertPoint(Miss);
+    Builder.CreateCondBr(Builder.CreateIsNull(SlotAddress), Claim, Next);
+    Builder.SetInsertPoint(Claim);
+    Builder.CreateStore(Address, AddressPtr);
+    Builder.CreateStore(One, CountPtr);
+    Builder.CreateRetVoid();
+
+    Builder.SetInsertPoint(Next);
+  }
+  // All slots are taken by other targets.
+  Value *OtherPtr = Builder.CreateStructGEP(Counters, 2);
+  Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(OtherPtr), One),
+                      OtherPtr);
+  Builder.CreateRetVoid();
+  return Recorder;
+}
+
+Function *FinishIndirectCallProfile() {
+  if (SiteCounters.empty())
+    return 0;
+
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Type *Int64Ty = Type::getInt64Ty(Context);
+
+  // The table of functions defined in this module.
+  std::vector<Constant *> Functions;
+  StructType *FunctionEntryTy = StructType::get(Int64Ty, Int64Ty, NULL);
+  for (Module::iterator I = TheModule->begin(), E = TheModule->end(); I != E;
+       ++I) {
+    if (I->isDeclaration() || I->hasAvailableExternallyLinkage())
+      continue;
+    Constant *Address = TheFolder->CreatePtrToInt(I, Int64Ty);
+    Constant *Hash =
+        ConstantInt::get(Int64Ty, getProfileHash(getProfileName(I)));
+    Functions.push_back(
+        ConstantStruct::get(FunctionEntryTy, Address, Hash, NULL));
+  }
+  ArrayType *FunctionsTy = ArrayType::get(FunctionEntryTy, Functions.size());
+
+  // The table of call sites.
+  std::vector<Constant *> Sites;
+  for (unsigned i = 0, e = SiteCounters.size(); i != e; ++i)
+    Sites.push_back(SiteCounters[i].second->getInitializer());
+  ArrayType *SitesTy = ArrayType::get(getSiteType(), Sites.size());
+
+  // Put the header and the two tables together into one block, which can be
+  // written out in one go.
+  StructType *BlockTy = StructType::get(Int32Ty, Int32Ty, Int64Ty, Int32Ty,
+                                        Int32Ty, FunctionsTy, SitesTy, NULL);
+  Constant *Init = ConstantStruct::get(
+      BlockTy, ConstantInt::get(Int32Ty, ICallProfileMagic),
+      ConstantInt::get(Int32Ty, ICallProfileVersion),
+      ConstantInt::get(Int64Ty, 0), ConstantInt::get(Int32Ty, Functions.size()),
+      ConstantInt::get(Int32Ty, Sites.size()),
+      ConstantArray::get(FunctionsTy, Functions),
+      ConstantArray::get(SitesTy, Sites), NULL);
+  GlobalVariable *Block =
+      new GlobalVariable(*TheModule, BlockTy, false,
+                         GlobalValue::InternalLinkage, Init, "icall.profile");
+
+  // Redirect the per-site counters to the block.
+  for (unsigned i = 0, e = SiteCounters.size(); i != e; ++i) {
+    Constant *Idx[] = { ConstantInt::get(Int32Ty, 0),
+                        ConstantInt::get(Int32Ty, 6),
+                        ConstantInt::get(Int32Ty, i) };
+    GlobalVariable *GV = SiteCounters[i].second;
+    GV->replaceAllUsesWith(
+        TheFolder->CreateInBoundsGetElementPtr(Block, Idx));
+    GV->eraseFromParent();
+  }
+  SiteCounters.clear();
+
+  // void dragonegg.icall.write() - append the block to the profile file.
+  Function *Writer = Function::Create(
+      FunctionType::get(Type::getVoidTy(Context), false),
+      GlobalValue::InternalLinkage, "dragonegg.icall.write", TheModule);
+  Writer->addFnAttr(Attribute::NoUnwind);
+  LLVMBuilder Builder(Context, *TheFolder);
+  Builder.SetInsertPoint(BasicBlock::Create(Context, "entry", Writer));
+
+  Type *Int8PtrTy = Type::getInt8PtrTy(Context);
+  Type *SizeTy = getDataLayout().getIntPtrType(Context);
+  Constant *FOpen = TheModule->getOrInsertFunction(
+      "fopen", Int8PtrTy, Int8PtrTy, Int8PtrTy, NULL);
+  Constant *FWrite = TheModule->getOrInsertFunction(
+      "fwrite", SizeTy, Int8PtrTy, SizeTy, SizeTy, Int8PtrTy, NULL);
+  Constant *FClose =
+      TheModule->getOrInsertFunction("fclose", Int32Ty, Int8PtrTy, NULL);
+  Constant *GetPID = TheModule->getOrInsertFunction("getpid", Int32Ty, NULL);
+  Constant *Time =
+      TheModule->getOrInsertFunction("time", SizeTy, Int8PtrTy, NULL);
+
+  // The run ID is shared by all of the compilation units in the program, since
+  // the profile of one refers to functions in the others.  Whichever unit is
+  // written first computes it.  Process IDs are reused, so also use the time.
+  GlobalVariable *RunID = TheModule->getGlobalVariable("__dragonegg_icall_run");
+  if (!RunID)
+    RunID = new GlobalVariable(*TheModule, Int64Ty, false,
+                               GlobalValue::LinkOnceAnyLinkage,
+                               ConstantInt::get(Int64Ty, 0),
+                               "__dragonegg_icall_run");
+
+  Value *Stream = Builder.CreateCall2(
+      FOpen, Builder.CreateGlobalStringPtr(ICallProfileGenerateFile),
+      Builder.CreateGlobalStringPtr("ab"));
+  BasicBlock *Write = BasicBlock::Create(Context, "write", Writer);
+  BasicBlock *Done = BasicBlock::Create(Context, "done", Writer);
+  Builder.CreateCondBr(Builder.CreateIsNull(Stream), Done, Write);
+
+  Builder.SetInsertPoint(Write);
+  BasicBlock *NewRun = BasicBlock::Create(Context, "newrun", Writer);
+  BasicBlock *WriteBlock = BasicBlock::Create(Context, "writeblock", Writer);
+  Builder.CreateCondBr(Builder.CreateIsNull(Builder.CreateLoad(RunID)), NewRun,
+                       WriteBlock);
+
+  Builder.SetInsertPoint(NewRun);
+  Value *PID = Builder.CreateZExt(Builder.CreateCall(GetPID), Int64Ty);
+  Value *Now = Builder.CreateZExtOrTrunc(
+      Builder.CreateCall(Time, Constant::getNullValue(Int8PtrTy)), Int64Ty);
+  Builder.CreateStore(Builder.CreateOr(Builder.CreateShl(Now, 32), PID), RunID);
+  Builder.CreateBr(WriteBlock);
+
+  Builder.SetInsertPoint(WriteBlock);
+  Builder.CreateStore(Builder.CreateLoad(RunID),
+                      Builder.CreateStructGEP(Block, 2));
+  Builder.CreateCall4(
+      FWrite, Builder.CreateBitCast(Block, Int8PtrTy),
+      ConstantInt::get(SizeTy, getDataLayout().getTypeAllocSize(BlockTy)),
+      ConstantInt::get(SizeTy, 1), Stream);
+  Builder.CreateCall(FClose, Stream);
+  Builder.CreateBr(Done);
+
+  Builder.SetInsertPoint(Done);
+  Builder.CreateRetVoid();
+  return Writer;
+}
+
+//===----------------------------------------------------------------------===//
+//                        ... Indirect Call Feedback ...
+//===----------------------------------------------------------------------===//
+
+/// ICallTarget - The number of calls made from a site to one function.
+struct ICallTarget {
+  uint64_t NameHash;
+  uint64_t Count;
+  bool operator<(const ICallTarget &RHS) const { return Count > RHS.Count; }
+};
+
+/// ICallSiteProfile - The profile for one call site.
+struct ICallSiteProfile {
+  uint64_t Total;
+  SmallVector<ICallTarget, ICallTargetsPerSite> Targets;
+  ICallSiteProfile() : Total(0) {}
+};
+
+/// SiteProfiles - The profile read from ICallProfileUseFile, indexed by site.
+static DenseMap<uint64_t, ICallSiteProfile> SiteProfiles;
+
+/// ProfileReader - Helper for reading the fields of a profile in order.
+class ProfileReader {
+  const char *Cur, *End;
+
+public:
+  ProfileReader(const MemoryBuffer &Buffer)
+      : Cur(Buffer.getBufferStart()), End(Buffer.getBufferEnd()) {}
+
+  bool atEnd() const { return Cur == End; }
+  bool has(uint64_t Bytes) const { return (uint64_t)(End - Cur) >= Bytes; }
+
+  template <typename T> T read() {
+    T Val;
+    memcpy(&Val, Cur, sizeof(T));
+    Cur += sizeof(T);
+    return Val;
+  }
+};
+
+bool LoadIndirectCallProfile(const char *FileName, std::string &Error) {
+  // Map the file into memory rather than reading it: profiles merged from many
+  // runs can be big.
+  ErrorOr<std::unique_ptr<MemoryBuffer> > BufferOrErr =
+      MemoryBuffer::getFile(FileName, -1, /*RequiresNullTerminator*/ false);
+  if (std::error_code EC = BufferOrErr.getError()) {
+    Error = EC.message();
+    return false;
+  }
+  const MemoryBuffer &Buffer = *BufferOrErr.get();
+
+  const uint64_t HeaderSize = 24, FunctionSize = 16,
+                 SiteSize = 16 + 16 * ICallTargetsPerSite;
+
+  // First pass: work out which function lives at each address in each run.
+  typedef std::pair<uint64_t, uint64_t> RunAddress;
+  DenseMap<RunAddress, uint64_t> FunctionAt;
+  for (ProfileReader R(Buffer); !R.atEnd();) {
+    if (!R.has(HeaderSize) || R.read<uint32_t>() != ICallProfileMagic ||
+        R.read<uint32_t>() != ICallProfileVersion) {
+      Error = "not an indirect call profile, or corrupt";
+      return false;
+    }
+    uint64_t RunID = R.read<uint64_t>();
+    uint32_t NumFunctions = R.read<uint32_t>();
+    uint32_t NumSites = R.read<uint32_t>();
+    if (!R.has(NumFunctions * FunctionSize + NumSites * SiteSize)) {
+      Error = "truncated profile";
+      return false;
+    }
+    for (unsigned i = 0; i != NumFunctions; ++i) {
+      uint64_t Address = R.read<uint64_t>();
+      FunctionAt[RunAddress(RunID, Address)] = R.read<uint64_t>();
+    }
+    for (unsigned i = 0; i != NumSites; ++i)
+      for (unsigned j = 0; j != SiteSize / 8; ++j)
+        R.read<uint64_t>();
+  }
+
+  // Second pass: add up the number of calls from each site to each function.
+  // Calls to functions that were not compiled with instrumentation, such as
+  // functions in system libraries, only contribute to the total.
+  DenseMap<RunAddress, uint64_t> Counts;
+  for (ProfileReader R(Buffer); !R.atEnd();) {
+    R.read<uint32_t>();
+    R.read<uint32_t>();
+    uint64_t RunID = R.read<uint64_t>();
+    uint32_t NumFunctions = R.read<uint32_t>();
+    uint32_t NumSites = R.read<uint32_t>();
+    for (unsigned i = 0; i != NumFunctions * FunctionSize / 8; ++i)
+      R.read<uint64_t>();
+    for (unsigned i = 0; i != NumSites; ++i) {
+      uint64_t SiteID = R.read<uint64_t>();
+      ICallSiteProfile &Site = SiteProfiles[SiteID];
+      for (unsigned j = 0; j != ICallTargetsPerSite; ++j) {
+        uint64_t Address = R.read<uint64_t>();
+        uint64_t Count = R.read<uint64_t>();
+        Site.Total += Count;
+        DenseMap<RunAddress, uint64_t>::iterator I =
+            FunctionAt.find(RunAddress(RunID, Address));
+        if (Address && I != FunctionAt.end())
+          Counts[RunAddress(SiteID, I->second)] += Count;
+      }
+      Site.Total += R.read<uint64_t>();
+    }
+  }
+
+  for (DenseMap<RunAddress, uint64_t>::iterator I = Counts.begin(),
+       E = Counts.end(); I != E; ++I) {
+    ICallTarget Target = { I->first.second, I->second };
+    SiteProfiles[I->first.first].Targets.push_back(Target);
+  }
+  for (DenseMap<uint64_t, ICallSiteProfile>::iterator I = SiteProfiles.begin(),
+       E = SiteProfiles.end(); I != E; ++I)
+    std::sort(I->second.Targets.begin(), I->second.Targets.end());
+  return true;
+}
+
+/// getFunctionByProfileHash - Return the function in the current module with
+/// the given profile name hash, or null if there is none.
+static Function *getFunctionByProfileHash(uint64_t Hash) {
+  static DenseMap<uint64_t, WeakVH> FunctionsByHash;
+  // The last function added to FunctionsByHash.
+  static WeakVH LastHashed;
+  DenseMap<uint64_t, WeakVH>::iterator I = FunctionsByHash.find(Hash);
+  if (I != FunctionsByHash.end() && I->second)
+    return dyn_cast<Function>(I->second);
+  // Functions are created as the compilation unit is converted, and are added
+  // to the end of the module, so hash any created since the last look.  Start
+  // again from the beginning if the last function hashed was deleted.
+  Module::iterator FI = TheModule->begin(), FE = TheModule->end();
+  if (Function *Last = dyn_cast_or_null<Function>(LastHashed))
+    FI = std::next(Module::iterator(Last));
+  for (; FI != FE; ++FI) {
+    FunctionsByHash[getProfileHash(getProfileName(FI))] = &*FI;
+    LastHashed = &*FI;
+  }
+  I = FunctionsByHash.find(Hash);
+  return I != FunctionsByHash.end() ? dyn_cast_or_null<Function>(I->second)
+                                    : 0;
+}
+
+void getIndirectCallTargets(
+    uint64_t SiteID, FunctionType *FTy, CallingConv::ID CC,
+    SmallVectorImpl<std::pair<Function *, uint64_t> > &Targets,
+    uint64_t &Total) {
+  DenseMap<uint64_t, ICallSiteProfile>::iterator I = SiteProfiles.find(SiteID);
+  if (I == SiteProfiles.end())
+    return;
+  const ICallSiteProfile &Site = I->second;
+  Total = Site.Total;
+
+  uint64_t Remaining = Site.Total;
+  for (unsigned i = 0, e = Site.Targets.size();
+       i != e && Targets.size() < MaxPromotedTargets; ++i) {
+    const ICallTarget &Target = Site.Targets[i];
+    // The targets are sorted by decreasing count, so give up at the first one
+    // that is not called often enough.
+    if (Target.Count < ICallPromotionMinCount ||
+        Target.Count * 100 < Remaining * ICallPromotionPercent)
+      break;
+    Function *F = getFunctionByProfileHash(Target.NameHash);
+    if (!F || F->getFunctionType() != FTy || F->getCallingConv() != CC)
+      continue;
+    Targets.push_back(std::make_pair(F, Target.Count));
+    Remaining -= Target.Count;
+  }
+}
@@ -59,6 +59,12 @@ extern "C" {
 
 using namespace llvm;
 
+// Whether -fcheck-new was specified.
+// In GCC < 4.6, this variable is only defined in the C++ front end.
+#if (GCC_MINOR < 6)
+extern int flag_check_new __attribute__((weak));
+#endif
+
 static LLVMContext &Context = getGlobalContext();
 
 /// SCCInProgress - Set of mutually dependent types currently being converted.
@@ -226,75 +232,78 @@ uint64_t ArrayLengthOf(tree type) {
   return Range < 0 ? 0 : 1 + (uint64_t) Range;
 }
 
-/// set_decl_index - Associate a non-negative number with the given GCC
-/// field declaration.
-static int set_decl_index(tree t, int i) {
-  assert(i >= 0 && "Negative indices not allowed!");
-  setCachedInteger(t, i);
-  return i;
-}
-
-/// get_decl_index - Get the non-negative number associated with the given GCC
-/// field decl.  Returns a negative value if no such association has been made.
-static int get_decl_index(tree t) {
-  int Idx;
-  if (getCachedInteger(t, Idx))
-    return Idx;
-  return -1;
-}
-
-/// GetFieldIndex - Return the index of the field in the given LLVM type that
-/// corresponds to the GCC field declaration 'decl'.  This means that the LLVM
-/// and GCC fields start in the same byte (if 'decl' is a bitfield, this means
-/// that its first bit is within the byte the LLVM field starts at).  Returns
-/// INT_MAX if there is no such LLVM field.
-int GetFieldIndex(tree decl, Type *Ty) {
-  assert(isa<FIELD_DECL>(decl) && "Expected a FIELD_DECL!");
-  // FIXME: The following test sometimes fails when compiling Fortran90 because
-  // DECL_CONTEXT does not point to the containing type, but some other type!
-  //  assert(Ty == ConvertType(DECL_CONTEXT(decl)) && "Field not for this type!");
-
-  // If we previously cached the field index, return the cached value.
-  unsigned Index = (unsigned) get_decl_index(decl);
-  if (Index <= INT_MAX)
-    return Index;
-
-  // TODO: At this point we could process all fields of DECL_CONTEXT(decl), and
-  // incrementally advance over the StructLayout.  This would make indexing be
-  // O(N) rather than O(N log N) if all N fields are used.  It's not clear if it
-  // would really be a win though.
+/// FieldLayouts - The layouts computed so far.  Each FIELD_DECL is associated
+/// with the position of its layout in this table using the integer cache, so
+/// that the association goes away if the field is garbage collected.
+static std::vector<FieldLayout> FieldLayouts;
 
+/// ComputeFieldIndex - Work out the index of the field in the given LLVM type
+/// that corresponds to the GCC field declaration 'decl', see GetFieldIndex.
+static int ComputeFieldIndex(tree decl, Type *Ty) {
   StructType *STy = dyn_cast<StructType>(Ty);
   // If this is not a struct type, then for sure there is no corresponding LLVM
   // field (we do not require GCC record types to be converted to LLVM structs).
   if (!STy)
-    return set_decl_index(decl, INT_MAX);
+    return INT_MAX;
 
   // If this is an empty struct then there is no corresponding LLVM field.
   if (STy->element_begin() == STy->element_end())
-    return set_decl_index(decl, INT_MAX);
+    return INT_MAX;
 
   // If the field declaration is at a variable or humongous offset then there
   // can be no corresponding LLVM field.
   if (!OffsetIsLLVMCompatible(decl))
-    return set_decl_index(decl, INT_MAX);
+    return INT_MAX;
 
   // Find the LLVM field that contains the first bit of the GCC field.
   uint64_t OffsetInBytes = getFieldOffsetInBits(decl) / 8; // Ignore bit in byte
   const StructLayout *SL = getDataLayout().getStructLayout(STy);
-  Index = SL->getElementContainingOffset(OffsetInBytes);
+  unsigned Index = SL->getElementContainingOffset(OffsetInBytes);
 
   // The GCC field must start in the first byte of the LLVM field.
   if (OffsetInBytes != SL->getElementOffset(Index))
-    return set_decl_index(decl, INT_MAX);
+    return INT_MAX;
 
-  // We are not able to cache values bigger than INT_MAX, so bail out if the
-  // LLVM field index is that huge.
+  // Bail out if the LLVM field index is too huge to return.
   if (Index >= INT_MAX)
-    return set_decl_index(decl, INT_MAX);
+    return INT_MAX;
 
   // Found an appropriate LLVM field - return it.
-  return set_decl_index(decl, Index);
+  return Index;
+}
+
+/// GetFieldLayout - Return the layout of the field declaration 'decl' within
+/// the given LLVM type, which should be the type of the containing record.
+FieldLayout GetFieldLayout(tree decl, Type *Ty) {
+  assert(isa<FIELD_DECL>(decl) && "Expected a FIELD_DECL!");
+  // FIXME: The following test sometimes fails when compiling Fortran90 because
+  // DECL_CONTEXT does not point to the containing type, but some other type!
+  //  assert(Ty == ConvertType(DECL_CONTEXT(decl)) && "Field not for this type!");
+
+  // If we previously computed the layout, return it.
+  int Slot;
+  if (getCachedInteger(decl, Slot))
+    return FieldLayouts[Slot];
+
+  FieldLayout L;
+  L.Index = ComputeFieldIndex(decl, Ty);
+  L.BitOffset = getInt64(DECL_FIELD_BIT_OFFSET(decl), true);
+  L.Alignment = getFieldAlignment(decl);
+  L.Bitfield = isBitfield(decl);
+
+  assert(FieldLayouts.size() < INT_MAX && "Too many fields!");
+  setCachedInteger(decl, (int) FieldLayouts.size());
+  FieldLayouts.push_back(L);
+  return L;
+}
+
+/// GetFieldIndex - Return the index of the field in the given LLVM type that
+/// corresponds to the GCC field declaration 'decl'.  This means that the LLVM
+/// and GCC fields start in the same byte (if 'decl' is a bitfield, this means
+/// that its first bit is within the byte the LLVM field starts at).  Returns
+/// INT_MAX if there is no such LLVM field.
+int GetFieldIndex(tree decl, Type *Ty) {
+  return GetFieldLayout(decl, Ty).Index;
 }
 
 /// getPointerToType - Returns the LLVM register type to use for a pointer to
@@ -726,6 +735,21 @@ FunctionType *ConvertArgListToFnType(
   return FunctionType::get(RetTy, ArgTys, false);
 }
 
+/// isNonNullArgument - Return whether the given nonnull attribute applies to
+/// argument number ArgNo (counting from one).
+static bool isNonNullArgument(tree NonNull, unsigned ArgNo) {
+  for (; NonNull; NonNull = lookup_attribute("nonnull", TREE_CHAIN(NonNull))) {
+    // An attribute with no argument list applies to every pointer argument.
+    if (!TREE_VALUE(NonNull))
+      return true;
+    for (tree Arg = TREE_VALUE(NonNull); Arg; Arg = TREE_CHAIN(Arg))
+      if (isa<INTEGER_CST>(TREE_VALUE(Arg)) &&
+          TREE_INT_CST_LOW(TREE_VALUE(Arg)) == ArgNo)
+        return true;
+  }
+  return false;
+}
+
 FunctionType *
 ConvertFunctionType(tree type, tree decl, tree static_chain,
                     CallingConv::ID &CallingConv, AttributeSet &PAL) {
@@ -749,13 +773,15 @@ ConvertFunctionType(tree type, tree decl, tree static_chain,
 
   int flags = flags_from_decl_or_type(decl ? decl : type);
 
-  // Check for 'readnone' and 'readonly' function attributes.
-  if (flags & ECF_CONST)
-    FnAttrBuilder.addAttribute(Attribute::ReadNone);
-  else if (flags & ECF_PURE)
-    FnAttrBuilder.addAttribute(Attribute::ReadOnly);
-
-  // TODO: Handle ECF_LOOPING_CONST_OR_PURE
+  // Check for 'readnone' and 'readonly' function attributes.  LLVM deletes a
+  // call to such a function if the result is not used, which is wrong if the
+  // function might loop forever.
+  if (!(flags & ECF_LOOPING_CONST_OR_PURE)) {
+    if (flags & ECF_CONST)
+      FnAttrBuilder.addAttribute(Attribute::ReadNone);
+    else if (flags & ECF_PURE)
+      FnAttrBuilder.addAttribute(Attribute::ReadOnly);
+  }
 
   // Check for 'noreturn' function attribute.
   if (flags & ECF_NORETURN)
@@ -769,6 +795,12 @@ ConvertFunctionType(tree type, tree decl, tree static_chain,
   if (flags & ECF_RETURNS_TWICE)
     FnAttrBuilder.addAttribute(Attribute::ReturnsTwice);
 
+  // Check for the 'cold' and 'hot' attributes.
+  if (decl && lookup_attribute("cold", DECL_ATTRIBUTES(decl)))
+    FnAttrBuilder.addAttribute(Attribute::Cold);
+  else if (decl && lookup_attribute("hot", DECL_ATTRIBUTES(decl)))
+    FnAttrBuilder.addAttribute(Attribute::InlineHint);
+
   // Since they write the return value through a pointer,
   // 'sret' functions cannot be 'readnone' or 'readonly'.
   if (ABIConverter.isShadowReturn()) {
@@ -797,6 +829,12 @@ ConvertFunctionType(tree type, tree decl, tree static_chain,
   if (flags & ECF_MALLOC)
     RAttrBuilder.addAttribute(Attribute::NoAlias);
 
+  // An operator new that may throw reports failure by throwing an exception,
+  // so it never returns null unless -fcheck-new says otherwise.
+  if (decl && DECL_IS_OPERATOR_NEW(decl) && !TREE_NOTHROW(decl) &&
+      !flag_check_new && RetTy->isPointerTy())
+    RAttrBuilder.addAttribute(Attribute::NonNull);
+
   if (RAttrBuilder.hasAttributes())
     Attrs.push_back(
         AttributeSet::get(Context, AttributeSet::ReturnIndex, RAttrBuilder));
@@ -809,6 +847,11 @@ ConvertFunctionType(tree type, tree decl, tree static_chain,
     Attrs.push_back(AttributeSet::get(Context, ArgTypes.size(), B));
   }
 
+  // The nonnull attribute lists the (one based) numbers of the arguments that
+  // must not be null.  If no arguments are listed then it applies to all of
+  // the pointer arguments.
+  tree NonNull = lookup_attribute("nonnull", TYPE_ATTRIBUTES(type));
+
   std::vector<Type *> ScalarArgs;
   if (static_chain) {
     // Pass the static chain as the first parameter.
@@ -833,7 +876,9 @@ ConvertFunctionType(tree type, tree decl, tree static_chain,
   tree DeclArgs = (decl) ? DECL_ARGUMENTS(decl) : NULL;
   // Loop over all of the arguments, adding them as we go.
   tree Args = TYPE_ARG_TYPES(type);
+  unsigned ArgNo = 0;
   for (; Args && TREE_VALUE(Args) != void_type_node; Args = TREE_CHAIN(Args)) {
+    ++ArgNo;
     tree ArgTy = TREE_VALUE(Args);
     if (!isPassedByInvisibleReference(ArgTy))
       if (const StructType *STy = dyn_cast<StructType>(ConvertType(ArgTy)))
@@ -867,6 +912,12 @@ ConvertFunctionType(tree type, tree decl, tree static_chain,
     if (isa<ACCESS_TYPE>(RestrictArgTy) && TYPE_RESTRICT(RestrictArgTy))
       PAttrBuilder.addAttribute(Attribute::NoAlias);
 
+    // Compute nonnull attributes, for arguments passed as a single pointer.
+    if (NonNull && isa<POINTER_TYPE>(ArgTy) &&
+        ArgTypes.size() == OldSize + 1 && ArgTypes.back()->isPointerTy() &&
+        isNonNullArgument(NonNull, ArgNo))
+      PAttrBuilder.addAttribute(Attribute::NonNull);
+
 #ifdef LLVM_TARGET_ENABLE_REGPARM
     // Allow the target to mark this as inreg.
     if (isa<INTEGRAL_TYPE>(ArgTy) || isa<ACCESS_TYPE>(ArgTy) ||
@@ -1229,6 +1280,13 @@ static Type *ConvertRecordTypeRecursive(tree type) {
   assert(STy && isa<StructType>(STy) && cast<StructType>(STy)->isOpaque() &&
          "Incorrect placeholder for struct type!");
   cast<StructType>(STy)->setBody(Elts, Pack);
+
+  // Now that the LLVM type is complete, work out where each field lives in it
+  // so that accesses to the fields need not.
+  for (tree field = TYPE_FIELDS(type); field; field = TREE_CHAIN(field))
+    if (isa<FIELD_DECL>(field))
+      GetFieldLayout(field, STy);
+
   return STy;
 }
 
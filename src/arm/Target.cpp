@@ -499,33 +499,31 @@ Type *llvm_arm_aggr_type_for_struct_return(tree TreeType, CallingConv::ID CC) {
 //
 // Here, SRC is returning multiple values. DEST's DESTFIELDNO field is an array.
 // Extract SRCFIELDNO's ELEMENO value and store it in DEST's FIELDNO field's
-// ELEMENTNO.
+// ELEMENTNO.  DEST is aligned to ALIGN bytes.
 //
 static void llvm_arm_extract_mrv_array_element(
     Value *Src, Value *Dest, unsigned SrcFieldNo, unsigned SrcElemNo,
-    unsigned DestFieldNo, unsigned DestElemNo, LLVMBuilder &Builder,
-    bool isVolatile) {
+    unsigned DestFieldNo, unsigned DestElemNo, unsigned Align,
+    LLVMBuilder &Builder, bool isVolatile) {
   Value *EVI = Builder.CreateExtractValue(Src, SrcFieldNo, "mrv_gr");
   const StructType *STy = cast<StructType>(Src->getType());
-  llvm::Value *Idxs[3];
-  Idxs[0] = ConstantInt::get(llvm::Type::getInt32Ty(Context), 0);
-  Idxs[1] = ConstantInt::get(llvm::Type::getInt32Ty(Context), DestFieldNo);
-  Idxs[2] = ConstantInt::get(llvm::Type::getInt32Ty(Context), DestElemNo);
-  Value *GEP = Builder.CreateGEP(Dest, Idxs, "mrv_gep");
+  unsigned Idxs[2] = { DestFieldNo, DestElemNo };
   if (STy->getElementType(SrcFieldNo)->isVectorTy()) {
     Value *ElemIndex = ConstantInt::get(Type::getInt32Ty(Context), SrcElemNo);
     Value *EVIElem = Builder.CreateExtractElement(EVI, ElemIndex, "mrv");
-    Builder.CreateAlignedStore(EVIElem, GEP, 1, isVolatile);
+    StoreMultipleReturnValuePiece(EVIElem, Dest, Idxs, Align, isVolatile,
+                                  Builder);
   } else {
-    Builder.CreateAlignedStore(EVI, GEP, 1, isVolatile);
+    StoreMultipleReturnValuePiece(EVI, Dest, Idxs, Align, isVolatile, Builder);
   }
 }
 
 // llvm_arm_extract_multiple_return_value - Extract multiple values returned
-// by SRC and store them in DEST. It is expected that SRC and
-// DEST types are StructType, but they may not match.
+// by SRC and store them in DEST, which is aligned to ALIGN bytes. It is
+// expected that SRC and DEST types are StructType, but they may not match.
 void llvm_arm_extract_multiple_return_value(
-    Value *Src, Value *Dest, bool isVolatile, LLVMBuilder &Builder) {
+    Value *Src, Value *Dest, unsigned Align, bool isVolatile,
+    LLVMBuilder &Builder) {
   const StructType *STy = cast<StructType>(Src->getType());
   unsigned NumElements = STy->getNumElements();
 
@@ -541,9 +539,8 @@ void llvm_arm_extract_multiple_return_value(
 
     // Directly access first class values.
     if (DestElemType->isSingleValueType()) {
-      Value *GEP = Builder.CreateStructGEP(Dest, DNO, "mrv_gep");
       Value *EVI = Builder.CreateExtractValue(Src, SNO, "mrv_gr");
-      Builder.CreateAlignedStore(EVI, GEP, 1, isVolatile);
+      StoreMultipleReturnValuePiece(EVI, Dest, DNO, Align, isVolatile, Builder);
       ++DNO;
       ++SNO;
       continue;
@@ -564,7 +561,7 @@ void llvm_arm_extract_multiple_return_value(
       }
       while (i < Size) {
         llvm_arm_extract_mrv_array_element(Src, Dest, SNO, i++, DNO, DElemNo++,
-                                           Builder, isVolatile);
+                                           Align, Builder, isVolatile);
       }
       // Consumed this src field. Try next one.
       ++SNO;
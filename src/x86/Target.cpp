@@ -25,6 +25,7 @@
 #include "dragonegg/Target.h"
 
 // LLVM headers
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/MC/SubtargetFeature.h"
 #include "llvm/IR/Module.h"
 
@@ -1069,6 +1070,61 @@ bool TreeToLLVM::TargetIntrinsicLower(
   llvm_unreachable("Forgot case for code?");
 }
 
+/* TargetVecWidenMult - Multiply the high or low halves of two 128 bit integer
+ * vectors giving products of twice the width, using the SSE multiplies that
+ * produce wide results directly rather than extending both operands first.
+ */
+bool TreeToLLVM::TargetVecWidenMult(Type *ResultType, Value *LHS, Value *RHS,
+                                    bool isHigh, bool isSigned,
+                                    Value *&Result) {
+  if (!TARGET_SSE2)
+    return false;
+  VectorType *OpTy = cast<VectorType>(LHS->getType());
+  unsigned NumElts = OpTy->getNumElements();
+  Type *EltTy = OpTy->getElementType();
+  unsigned Base = isHigh ? NumElts / 2 : 0;
+
+  if (NumElts == 8 && EltTy->isIntegerTy(16)) {
+    // <8 x i16> -> <4 x i32>: compute the low and high 16 bits of all eight
+    // products with pmullw and pmulhw/pmulhuw, then interleave the wanted half
+    // of them with punpcklwd/punpckhwd.  This avoids pmulld, which is slow and
+    // needs SSE4.1.
+    Value *Lo = Builder.CreateMul(LHS, RHS);
+    Function *MulHi = Intrinsic::getDeclaration(
+        TheModule,
+        isSigned ? Intrinsic::x86_sse2_pmulh_w : Intrinsic::x86_sse2_pmulhu_w);
+    Value *Hi = Builder.CreateCall2(MulHi, LHS, RHS);
+    SmallVector<Constant *, 8> Mask;
+    for (unsigned i = 0; i != NumElts / 2; ++i) {
+      Mask.push_back(Builder.getInt32(Base + i));
+      Mask.push_back(Builder.getInt32(NumElts + Base + i));
+    }
+    Result = Builder.CreateShuffleVector(Lo, Hi, ConstantVector::get(Mask));
+    Result = Builder.CreateBitCast(Result, ResultType);
+    return true;
+  }
+
+  if (NumElts == 4 && EltTy->isIntegerTy(32) && (!isSigned || TARGET_SSE4_1)) {
+    // <4 x i32> -> <2 x i64>: pmuludq/pmuldq multiply the even elements, so
+    // move the wanted pair of elements into positions 0 and 2.
+    Constant *Mask[4] = {
+      Builder.getInt32(Base), UndefValue::get(Builder.getInt32Ty()),
+      Builder.getInt32(Base + 1), UndefValue::get(Builder.getInt32Ty())
+    };
+    Value *Undef = UndefValue::get(OpTy);
+    LHS = Builder.CreateShuffleVector(LHS, Undef, ConstantVector::get(Mask));
+    RHS = Builder.CreateShuffleVector(RHS, Undef, ConstantVector::get(Mask));
+    Function *MulDQ = Intrinsic::getDeclaration(
+        TheModule,
+        isSigned ? Intrinsic::x86_sse41_pmuldq : Intrinsic::x86_sse2_pmulu_dq);
+    Result = Builder.CreateCall2(MulDQ, LHS, RHS);
+    Result = Builder.CreateBitCast(Result, ResultType);
+    return true;
+  }
+
+  return false;
+}
+
 /* Target hook for llvm-abi.h. It returns true if an aggregate of the
    specified type should be passed in memory. This is only called for
    x86-64. */
@@ -1756,33 +1812,31 @@ Type *llvm_x86_aggr_type_for_struct_return(tree type) {
 //
 // Here, SRC is returning multiple values. DEST's DESTFIELNO field is an array.
 // Extract SRCFIELDNO's ELEMENO value and store it in DEST's FIELDNO field's
-// ELEMENTNO.
+// ELEMENTNO.  DEST is aligned to ALIGN bytes.
 //
 static void llvm_x86_extract_mrv_array_element(
     Value *Src, Value *Dest, unsigned SrcFieldNo, unsigned SrcElemNo,
-    unsigned DestFieldNo, unsigned DestElemNo, LLVMBuilder &Builder,
-    bool isVolatile) {
+    unsigned DestFieldNo, unsigned DestElemNo, unsigned Align,
+    LLVMBuilder &Builder, bool isVolatile) {
   Value *EVI = Builder.CreateExtractValue(Src, SrcFieldNo, "mrv_gr");
   StructType *STy = cast<StructType>(Src->getType());
-  Value *Idxs[3];
-  Idxs[0] = ConstantInt::get(Type::getInt32Ty(Context), 0);
-  Idxs[1] = ConstantInt::get(Type::getInt32Ty(Context), DestFieldNo);
-  Idxs[2] = ConstantInt::get(Type::getInt32Ty(Context), DestElemNo);
-  Value *GEP = Builder.CreateGEP(Dest, Idxs, "mrv_gep");
+  unsigned Idxs[2] = { DestFieldNo, DestElemNo };
   if (STy->getElementType(SrcFieldNo)->isVectorTy()) {
     Value *ElemIndex = ConstantInt::get(Type::getInt32Ty(Context), SrcElemNo);
     Value *EVIElem = Builder.CreateExtractElement(EVI, ElemIndex, "mrv");
-    Builder.CreateAlignedStore(EVIElem, GEP, 1, isVolatile);
+    StoreMultipleReturnValuePiece(EVIElem, Dest, Idxs, Align, isVolatile,
+                                  Builder);
   } else {
-    Builder.CreateAlignedStore(EVI, GEP, 1, isVolatile);
+    StoreMultipleReturnValuePiece(EVI, Dest, Idxs, Align, isVolatile, Builder);
   }
 }
 
 // llvm_x86_extract_multiple_return_value - Extract multiple values returned
-// by SRC and store them in DEST. It is expected thaty SRC and
-// DEST types are StructType, but they may not match.
+// by SRC and store them in DEST, which is aligned to ALIGN bytes. It is
+// expected thaty SRC and DEST types are StructType, but they may not match.
 void llvm_x86_extract_multiple_return_value(
-    Value *Src, Value *Dest, bool isVolatile, LLVMBuilder &Builder) {
+    Value *Src, Value *Dest, unsigned Align, bool isVolatile,
+    LLVMBuilder &Builder) {
 
   StructType *STy = cast<StructType>(Src->getType());
   unsigned NumElements = STy->getNumElements();
@@ -1804,17 +1858,14 @@ void llvm_x86_extract_multiple_return_value(
 
     Value *E0Index = ConstantInt::get(Type::getInt32Ty(Context), 0);
     Value *EVI0 = Builder.CreateExtractElement(EVI, E0Index, "mrv.v");
-    Value *GEP0 = Builder.CreateStructGEP(Dest, 0, "mrv_gep");
-    Builder.CreateAlignedStore(EVI0, GEP0, 1, isVolatile);
+    StoreMultipleReturnValuePiece(EVI0, Dest, 0U, Align, isVolatile, Builder);
 
     Value *E1Index = ConstantInt::get(Type::getInt32Ty(Context), 1);
     Value *EVI1 = Builder.CreateExtractElement(EVI, E1Index, "mrv.v");
-    Value *GEP1 = Builder.CreateStructGEP(Dest, 1, "mrv_gep");
-    Builder.CreateAlignedStore(EVI1, GEP1, 1, isVolatile);
+    StoreMultipleReturnValuePiece(EVI1, Dest, 1U, Align, isVolatile, Builder);
 
-    Value *GEP2 = Builder.CreateStructGEP(Dest, 2, "mrv_gep");
     Value *EVI2 = Builder.CreateExtractValue(Src, 1, "mrv_gr");
-    Builder.CreateAlignedStore(EVI2, GEP2, 1, isVolatile);
+    StoreMultipleReturnValuePiece(EVI2, Dest, 2U, Align, isVolatile, Builder);
     return;
   }
 
@@ -1824,9 +1875,8 @@ void llvm_x86_extract_multiple_return_value(
 
     // Directly access first class values using getresult.
     if (DestElemType->isSingleValueType()) {
-      Value *GEP = Builder.CreateStructGEP(Dest, DNO, "mrv_gep");
       Value *EVI = Builder.CreateExtractValue(Src, SNO, "mrv_gr");
-      Builder.CreateAlignedStore(EVI, GEP, 1, isVolatile);
+      StoreMultipleReturnValuePiece(EVI, Dest, DNO, Align, isVolatile, Builder);
       ++DNO;
       ++SNO;
       continue;
@@ -1834,20 +1884,16 @@ void llvm_x86_extract_multiple_return_value(
 
     // Special treatement for _Complex.
     if (DestElemType->isStructTy()) {
-      Value *Idxs[3];
-      Idxs[0] = ConstantInt::get(Type::getInt32Ty(Context), 0);
-      Idxs[1] = ConstantInt::get(Type::getInt32Ty(Context), DNO);
-
-      Idxs[2] = ConstantInt::get(Type::getInt32Ty(Context), 0);
-      Value *GEP = Builder.CreateGEP(Dest, Idxs, "mrv_gep");
+      unsigned Idxs[2] = { DNO, 0 };
       Value *EVI = Builder.CreateExtractValue(Src, 0, "mrv_gr");
-      Builder.CreateAlignedStore(EVI, GEP, 1, isVolatile);
+      StoreMultipleReturnValuePiece(EVI, Dest, Idxs, Align, isVolatile,
+                                    Builder);
       ++SNO;
 
-      Idxs[2] = ConstantInt::get(Type::getInt32Ty(Context), 1);
-      GEP = Builder.CreateGEP(Dest, Idxs, "mrv_gep");
+      Idxs[1] = 1;
       EVI = Builder.CreateExtractValue(Src, 1, "mrv_gr");
-      Builder.CreateAlignedStore(EVI, GEP, 1, isVolatile);
+      StoreMultipleReturnValuePiece(EVI, Dest, Idxs, Align, isVolatile,
+                                    Builder);
       ++DNO;
       ++SNO;
       continue;
@@ -1872,7 +1918,7 @@ void llvm_x86_extract_multiple_return_value(
       }
       while (i < Size) {
         llvm_x86_extract_mrv_array_element(Src, Dest, SNO, i++, DNO, DElemNo++,
-                                           Builder, isVolatile);
+                                           Align, Builder, isVolatile);
       }
       // Consumed this src field. Try next one.
       ++SNO;
@@ -1936,37 +1982,233 @@ const char *llvm_x86_override_target_environment() {
 #endif
 }
 
+/// ISAFeature - An instruction set extension that GCC can be told about using a
+/// -m option, and the LLVM subtarget feature that corresponds to it.
+struct ISAFeature {
+  HOST_WIDE_INT Mask;  // The OPTION_MASK_ISA_* bit in ix86_isa_flags.
+  const char *Feature; // The LLVM feature, or null if LLVM has none.
+};
+
+/// ISAFeatures - The instruction set extensions known to this version of GCC.
+/// The features a GCC version supports are found by testing for its option
+/// masks, so any instruction set extension the user asks for is passed on.
+static const ISAFeature ISAFeatures[] = {
+  { OPTION_MASK_ISA_64BIT, "64bit" },
+  { OPTION_MASK_ISA_3DNOW, "3dnow" },
+  { OPTION_MASK_ISA_3DNOW_A, "3dnowa" },
+  { OPTION_MASK_ISA_MMX, "mmx" },
+  { OPTION_MASK_ISA_SSE, "sse" },
+  { OPTION_MASK_ISA_SSE2, "sse2" },
+  { OPTION_MASK_ISA_SSE3, "sse3" },
+  { OPTION_MASK_ISA_SSSE3, "ssse3" },
+  { OPTION_MASK_ISA_SSE4_1, "sse4.1" },
+  { OPTION_MASK_ISA_SSE4_2, "sse4.2" },
+  { OPTION_MASK_ISA_SSE4A, "sse4a" },
+  { OPTION_MASK_ISA_AVX, "avx" },
+  { OPTION_MASK_ISA_FMA, "fma" },
+  { OPTION_MASK_ISA_FMA4, "fma4" },
+  { OPTION_MASK_ISA_AES, "aes" },
+  { OPTION_MASK_ISA_PCLMUL, "pclmul" },
+#ifdef OPTION_MASK_ISA_CX16
+  { OPTION_MASK_ISA_CX16, "cx16" },
+#endif
+#ifdef OPTION_MASK_ISA_SAHF
+  { OPTION_MASK_ISA_SAHF, "sahf" },
+#endif
+  { OPTION_MASK_ISA_POPCNT, "popcnt" },
+  { OPTION_MASK_ISA_ABM, "lzcnt" }, // ABM is LZCNT plus POPCNT.
+#ifdef OPTION_MASK_ISA_XOP
+  { OPTION_MASK_ISA_XOP, "xop" },
+#endif
+#ifdef OPTION_MASK_ISA_LWP
+  { OPTION_MASK_ISA_LWP, 0 },
+#endif
+#ifdef OPTION_MASK_ISA_MOVBE
+  { OPTION_MASK_ISA_MOVBE, "movbe" },
+#endif
+#ifdef OPTION_MASK_ISA_CRC32
+  { OPTION_MASK_ISA_CRC32, 0 }, // Part of SSE4.2 as far as LLVM is concerned.
+#endif
+#ifdef OPTION_MASK_ISA_FSGSBASE
+  { OPTION_MASK_ISA_FSGSBASE, "fsgsbase" },
+#endif
+#ifdef OPTION_MASK_ISA_RDRND
+  { OPTION_MASK_ISA_RDRND, "rdrnd" },
+#endif
+#ifdef OPTION_MASK_ISA_F16C
+  { OPTION_MASK_ISA_F16C, "f16c" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX2
+  { OPTION_MASK_ISA_AVX2, "avx2" },
+#endif
+#ifdef OPTION_MASK_ISA_BMI
+  { OPTION_MASK_ISA_BMI, "bmi" },
+#endif
+#ifdef OPTION_MASK_ISA_BMI2
+  { OPTION_MASK_ISA_BMI2, "bmi2" },
+#endif
+#ifdef OPTION_MASK_ISA_LZCNT
+  { OPTION_MASK_ISA_LZCNT, "lzcnt" },
+#endif
+#ifdef OPTION_MASK_ISA_TBM
+  { OPTION_MASK_ISA_TBM, "tbm" },
+#endif
+#ifdef OPTION_MASK_ISA_RTM
+  { OPTION_MASK_ISA_RTM, "rtm" },
+#endif
+#ifdef OPTION_MASK_ISA_HLE
+  { OPTION_MASK_ISA_HLE, "hle" },
+#endif
+#ifdef OPTION_MASK_ISA_RDSEED
+  { OPTION_MASK_ISA_RDSEED, "rdseed" },
+#endif
+#ifdef OPTION_MASK_ISA_PRFCHW
+  { OPTION_MASK_ISA_PRFCHW, "prfchw" },
+#endif
+#ifdef OPTION_MASK_ISA_ADX
+  { OPTION_MASK_ISA_ADX, "adx" },
+#endif
+#ifdef OPTION_MASK_ISA_FXSR
+  { OPTION_MASK_ISA_FXSR, 0 },
+#endif
+#ifdef OPTION_MASK_ISA_XSAVE
+  { OPTION_MASK_ISA_XSAVE, 0 },
+#endif
+#ifdef OPTION_MASK_ISA_XSAVEOPT
+  { OPTION_MASK_ISA_XSAVEOPT, 0 },
+#endif
+#ifdef OPTION_MASK_ISA_SHA
+  { OPTION_MASK_ISA_SHA, "sha" },
+#endif
+#ifdef OPTION_MASK_ISA_PREFETCHWT1
+  { OPTION_MASK_ISA_PREFETCHWT1, "prefetchwt1" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX512F
+  { OPTION_MASK_ISA_AVX512F, "avx512f" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX512CD
+  { OPTION_MASK_ISA_AVX512CD, "avx512cd" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX512ER
+  { OPTION_MASK_ISA_AVX512ER, "avx512er" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX512PF
+  { OPTION_MASK_ISA_AVX512PF, "avx512pf" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX512BW
+  { OPTION_MASK_ISA_AVX512BW, "avx512bw" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX512DQ
+  { OPTION_MASK_ISA_AVX512DQ, "avx512dq" },
+#endif
+#ifdef OPTION_MASK_ISA_AVX512VL
+  { OPTION_MASK_ISA_AVX512VL, "avx512vl" },
+#endif
+};
+
+/// LLVMISAFeatures - The LLVM subtarget features for instruction set extensions.
+/// Those that no GCC option in ISAFeatures corresponds to are turned off, as
+/// otherwise the -mtune processor could turn them on.  The cx16 and sahf
+/// features are missing since every supported GCC version has options for them.
+static const char *const LLVMISAFeatures[] = {
+  "64bit", "3dnow", "3dnowa", "mmx", "sse", "sse2", "sse3", "ssse3", "sse4.1",
+  "sse4.2", "sse4a", "avx", "avx2", "avx512f", "avx512cd", "avx512er",
+  "avx512pf", "avx512bw", "avx512dq", "avx512vl", "fma", "fma4", "xop", "aes",
+  "pclmul", "popcnt", "lzcnt", "movbe", "fsgsbase", "rdrnd", "f16c", "bmi",
+  "bmi2", "tbm", "rtm", "hle", "rdseed", "prfchw", "adx", "sha"
+};
+
 static void addFeature(llvm::SubtargetFeatures &F, const char *Feature,
 		       bool Enabled) {
   const char *Prefix = Enabled ? "+" : "-";
   F.AddFeature(std::string(Prefix) + Feature);
 }
 
+/// getLLVMCPUName - Return the LLVM name for the given GCC processor.
+static std::string getLLVMCPUName(const char *Name) {
+  if (TARGET_MACHO && !strcmp(Name, "apple"))
+    return TARGET_64BIT ? "core2" : "yonah";
+  return Name;
+}
+
 void llvm_x86_set_subtarget_features(std::string &C,
                                      llvm::SubtargetFeatures &F) {
-  if (TARGET_MACHO && !strcmp(ix86_arch_string, "apple"))
-    C = TARGET_64BIT ? "core2" : "yonah";
-  else
-    C = ix86_arch_string;
-
-  addFeature(F, "64bit", TARGET_64BIT);
-  addFeature(F, "3dnow", TARGET_3DNOW);
-  addFeature(F, "3dnowa", TARGET_3DNOW_A);
-  addFeature(F, "aes", TARGET_AES);
-  addFeature(F, "avx", TARGET_AVX);
+  // LLVM has a single processor, which decides both the instructions that may
+  // be used and how the code is scheduled and tuned.  Use the -mtune processor
+  // so that code is tuned for it, and list all of the instruction set features
+  // so that only instructions allowed by -march are used.  If no processor was
+  // given for -mtune then GCC does generic tuning, for which the best match is
+  // the -march processor.
+  const char *Tune = ix86_tune_string;
+  if (!Tune || !strncmp(Tune, "generic", 7))
+    Tune = ix86_arch_string;
+  C = getLLVMCPUName(Tune);
+
+#ifdef TARGET_CMOVE
+  addFeature(F, "cmov", TARGET_CMOVE);
+#else
+  addFeature(F, "cmov", TARGET_CMOV);
+#endif
+
+  // Older versions of GCC do not keep these in ix86_isa_flags.
+#ifndef OPTION_MASK_ISA_CX16
   addFeature(F, "cx16", TARGET_CMPXCHG16B);
-  addFeature(F, "fma", TARGET_FMA);
-  addFeature(F, "fma4", TARGET_FMA4);
-  addFeature(F, "mmx", TARGET_MMX);
-  addFeature(F, "popcnt", TARGET_POPCNT);
-#ifdef TARGET_RDRND
-  addFeature(F, "rdrnd", TARGET_RDRND);
 #endif
-  addFeature(F, "sse", TARGET_SSE);
-  addFeature(F, "sse2", TARGET_SSE2);
-  addFeature(F, "sse3", TARGET_SSE3);
-  addFeature(F, "sse4.1", TARGET_SSE4_1);
-  addFeature(F, "sse4.2", TARGET_SSE4_2);
-  addFeature(F, "sse4a", TARGET_SSE4A);
-  addFeature(F, "ssse3", TARGET_SSSE3);
+#ifndef OPTION_MASK_ISA_SAHF
+  addFeature(F, "sahf", TARGET_SAHF);
+#endif
+
+  unsigned NumFeatures = array_lengthof(ISAFeatures);
+  for (unsigned i = 0; i != NumFeatures; ++i) {
+    const char *Feature = ISAFeatures[i].Feature;
+    if (!Feature)
+      continue;
+    // Several GCC options may correspond to the same LLVM feature, in which
+    // case the feature is enabled if any of them is.  Output it only once.
+    bool isFirst = true, Enabled = false;
+    for (unsigned j = 0; j != NumFeatures; ++j)
+      if (ISAFeatures[j].Feature && !strcmp(ISAFeatures[j].Feature, Feature)) {
+        isFirst &= j >= i;
+        Enabled |= (ix86_isa_flags & ISAFeatures[j].Mask) != 0;
+      }
+    if (isFirst)
+      addFeature(F, Feature, Enabled);
+  }
+
+  // Older versions of GCC know nothing of the more recent extensions, so never
+  // use them.
+  for (unsigned i = 0, e = array_lengthof(LLVMISAFeatures); i != e; ++i) {
+    bool isKnown = false;
+    for (unsigned j = 0; j != NumFeatures; ++j)
+      if (ISAFeatures[j].Feature &&
+          !strcmp(ISAFeatures[j].Feature, LLVMISAFeatures[i]))
+        isKnown = true;
+    if (!isKnown)
+      addFeature(F, LLVMISAFeatures[i], false);
+  }
+}
+
+void llvm_x86_set_target_machine_attributes(Function *F) {
+  if (TARGET_OMIT_LEAF_FRAME_POINTER)
+    F->addFnAttr("no-frame-pointer-elim-non-leaf", "true");
+
+  // The target attribute may change the instruction set for this function.
+  F->addFnAttr("use-soft-float", !TARGET_80387 && !TARGET_SSE ? "true" :
+                                                                "false");
+
+  // A function with the force_align_arg_pointer attribute may be called with
+  // a misaligned stack, as may any function if -mincoming-stack-boundary is
+  // less than the preferred boundary, so realign the stack on entry to it.
+  // GCC only does this if the function needs the extra alignment, but LLVM
+  // cannot tell that here.  -mstackrealign realigns every function and is
+  // handled by LLVM_SET_MACHINE_OPTIONS.
+  tree FnType = TREE_TYPE(current_function_decl);
+  if (lookup_attribute("force_align_arg_pointer", TYPE_ATTRIBUTES(FnType)) ||
+      INCOMING_STACK_BOUNDARY < PREFERRED_STACK_BOUNDARY) {
+    AttrBuilder B;
+    B.addStackAlignmentAttr(PREFERRED_STACK_BOUNDARY / 8);
+    F->addAttributes(AttributeSet::FunctionIndex,
+                     AttributeSet::get(F->getContext(),
+                                       AttributeSet::FunctionIndex, B));
+  }
 }
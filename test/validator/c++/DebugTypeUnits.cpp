@@ -0,0 +1,18 @@
+// RUN: %dragonegg -S -g -fdebug-types-section %s -o - | FileCheck %s
+// RUN: %dragonegg -S -g -fdebug-types-section %s -o - | FileCheck --check-prefix=ANON %s
+// Check that with -fdebug-types-section record types obeying the one definition
+// rule are identified by their mangled name, so that they can be put in type
+// units, while types local to this file are not.
+// XFAIL: gcc-4.5, gcc-4.6
+
+struct Pair { int a; int b; };
+// CHECK: metadata !"_ZTS4Pair"
+
+namespace {
+struct Local { int c; };
+}
+// ANON-NOT: _ZTSN12_GLOBAL__N_1
+
+int sum(Pair p, Local l) {
+  return p.a + p.b + l.c;
+}
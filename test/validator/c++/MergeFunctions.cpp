@@ -0,0 +1,19 @@
+// RUN: %dragonegg -S %s -o - -O1 -fplugin-arg-dragonegg-merge-functions | FileCheck %s
+
+struct A;
+struct B;
+
+template <typename T> __attribute__((noinline)) T *first(T **p) {
+  return p[0];
+}
+
+A *first_a(A **p) { return first(p); }
+B *first_b(B **p) { return first(p); }
+
+// One instantiation keeps the body, the other just calls it.
+// CHECK: define linkonce_odr {{.*}}@_Z5firstI1{{[AB]}}EPT_PS2_
+// CHECK: load
+// CHECK: define linkonce_odr {{.*}}@_Z5firstI1{{[AB]}}EPT_PS2_
+// CHECK-NOT: load
+// CHECK: call
+// CHECK: ret
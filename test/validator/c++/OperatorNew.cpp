@@ -0,0 +1,17 @@
+// RUN: %dragonegg -S %s -o - | FileCheck %s
+// RUN: %dragonegg -S %s -o - -fcheck-new | FileCheck %s --check-prefix=CHECKNEW
+
+#include <new>
+
+int *throwing() {
+  return new int;
+}
+
+int *nothrowing() {
+  return new (std::nothrow) int;
+}
+
+// CHECK: declare noalias nonnull i8* @_Znw{{[jm]}}(
+// CHECK-NOT: declare {{.*}}nonnull i8* @_ZnwmRKSt9nothrow_t
+// CHECK-NOT: declare {{.*}}nonnull i8* @_ZnwjRKSt9nothrow_t
+// CHECKNEW-NOT: nonnull
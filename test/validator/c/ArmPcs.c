@@ -0,0 +1,28 @@
+// RUN: %dragonegg -S -mfloat-abi=hard -mfpu=vfp %s -o - | FileCheck %s --check-prefix=HARD
+// RUN: %dragonegg -S -mfloat-abi=softfp -mfpu=vfp %s -o - | FileCheck %s --check-prefix=SOFTFP
+// RUN: %dragonegg -S -mfloat-abi=soft %s -o - | FileCheck %s --check-prefix=SOFT
+// Check that the ARM calling convention follows -mfloat-abi, and that the pcs
+// attribute overrides it.
+// XFAIL: i386, i486, i586, i686, x86_64, powerpc
+
+double plain(double x) {
+// HARD: define arm_aapcs_vfpcc double @plain(
+// SOFTFP: define double @plain(
+// SOFT: define double @plain(
+  return x + 1.0;
+}
+
+__attribute__((pcs("aapcs"))) double base(double x) {
+// HARD: define arm_aapcscc double @base(
+// SOFTFP: define arm_aapcscc double @base(
+// SOFT: define arm_aapcscc double @base(
+  return x + 2.0;
+}
+
+#ifndef __SOFTFP__
+__attribute__((pcs("aapcs-vfp"))) double vfp(double x) {
+// HARD: define arm_aapcs_vfpcc double @vfp(
+// SOFTFP: define arm_aapcs_vfpcc double @vfp(
+  return x + 3.0;
+}
+#endif
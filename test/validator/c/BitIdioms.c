@@ -0,0 +1,54 @@
+// RUN: %dragonegg -O1 -S %s -o - | FileCheck %s
+
+unsigned rotl(unsigned x, unsigned n) {
+// CHECK: @rotl
+// CHECK: [[AMT:%[^ ]+]] = and i32 %n, 31
+// CHECK: [[SHL:%[^ ]+]] = shl i32 %x, [[AMT]]
+// CHECK: [[SHR:%[^ ]+]] = lshr i32 %x,
+// CHECK: or i32 [[SHL]], [[SHR]]
+// CHECK: ret i32
+  return (x << n) | (x >> (-n & 31));
+}
+
+unsigned xor_masked(unsigned x, unsigned n) {
+// This is zero rather than x if n is zero, so is not a rotate.
+// CHECK: @xor_masked
+// CHECK-NOT: and i32 %n, 31
+// CHECK: xor i32
+// CHECK: ret i32
+  return (x << n) ^ (x >> (-n & 31));
+}
+
+unsigned bswap(unsigned x) {
+// CHECK: @bswap
+// CHECK: @llvm.bswap.i32
+  return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+unsigned popcount(unsigned x) {
+// CHECK: @popcount
+// CHECK: @llvm.ctpop.i32
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+static const int DeBruijn[32] = {
+  0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+  31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+};
+
+unsigned bswap_xor(unsigned a, unsigned b) {
+// CHECK: @bswap_xor
+// CHECK: [[X:%[^ ]+]] = xor i32
+// CHECK: @llvm.bswap.i32(i32 [[X]])
+  unsigned x = a ^ b;
+  return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+int ctz(unsigned x) {
+// CHECK: @ctz
+// CHECK: @llvm.cttz.i32
+  return DeBruijn[((x & -x) * 0x077CB531U) >> 27];
+}
@@ -0,0 +1,16 @@
+// RUN: %dragonegg -S %s -o - -O2 | FileCheck %s
+
+static inline int pick(int x) {
+  return __builtin_constant_p(x) ? 1 : 2;
+}
+
+// The argument only becomes constant once pick is inlined.
+// CHECK: @known
+// CHECK: ret i32 1
+int known(void) { return pick(42); }
+
+// CHECK: @unknown
+// CHECK: ret i32 2
+int unknown(int y) { return pick(y); }
+
+// CHECK-NOT: constant_p
@@ -0,0 +1,19 @@
+// RUN: %dragonegg -S %s -o - | FileCheck %s
+// Check that aggregate arguments passed in memory that the function only reads
+// are marked readonly and nocapture.
+// XFAIL: i386, i486, i586, i686
+
+struct Big { long a[16]; };
+
+long first(struct Big b) {
+// CHECK: define i64 @first({{.*(nocapture.*readonly|readonly.*nocapture)}}
+  return b.a[0] + b.a[15];
+}
+
+long bump(struct Big b) {
+// CHECK: define i64 @bump(
+// CHECK-NOT: readonly
+// CHECK: ret i64
+  b.a[0]++;
+  return b.a[0];
+}
@@ -0,0 +1,37 @@
+// RUN: %eggdragon -S -g -fplugin-arg-dragonegg-emit-obj -fplugin-arg-dragonegg-compress-debug-sections %s -o %t.o
+// RUN: llvm-objdump -h %t.o | FileCheck %s
+// Check that the debug info sections of objects written by LLVM are compressed
+// when asked.  The long field names make the string table worth compressing.
+
+// CHECK: .zdebug_str
+
+struct Compressible {
+  int a_rather_long_field_name_number_0;
+  int a_rather_long_field_name_number_1;
+  int a_rather_long_field_name_number_2;
+  int a_rather_long_field_name_number_3;
+  int a_rather_long_field_name_number_4;
+  int a_rather_long_field_name_number_5;
+  int a_rather_long_field_name_number_6;
+  int a_rather_long_field_name_number_7;
+  int a_rather_long_field_name_number_8;
+  int a_rather_long_field_name_number_9;
+  int a_rather_long_field_name_number_10;
+  int a_rather_long_field_name_number_11;
+  int a_rather_long_field_name_number_12;
+  int a_rather_long_field_name_number_13;
+  int a_rather_long_field_name_number_14;
+  int a_rather_long_field_name_number_15;
+  int a_rather_long_field_name_number_16;
+  int a_rather_long_field_name_number_17;
+  int a_rather_long_field_name_number_18;
+  int a_rather_long_field_name_number_19;
+  int a_rather_long_field_name_number_20;
+  int a_rather_long_field_name_number_21;
+  int a_rather_long_field_name_number_22;
+  int a_rather_long_field_name_number_23;
+};
+
+int first(struct Compressible *C) {
+  return C->a_rather_long_field_name_number_0;
+}
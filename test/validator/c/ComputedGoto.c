@@ -0,0 +1,27 @@
+// RUN: %dragonegg -O2 -fplugin-arg-dragonegg-llvm-ir-optimize=0 -S %s -o - | FileCheck %s
+// Check that each computed goto gets its own indirect branch, and that it jumps
+// to the address loaded by that goto rather than by some other one.
+
+int run(const unsigned char *code) {
+// CHECK: @run
+// CHECK: [[A1:%[^ ]+]] = load i8**
+// CHECK-NOT: {{^[^ ]}}
+// CHECK: indirectbr i8* [[A1]],
+// CHECK: [[A2:%[^ ]+]] = load i8**
+// CHECK-NOT: {{^[^ ]}}
+// CHECK: indirectbr i8* [[A2]],
+// CHECK: [[A3:%[^ ]+]] = load i8**
+// CHECK-NOT: {{^[^ ]}}
+// CHECK: indirectbr i8* [[A3]],
+  static void *dispatch[] = { &&inc, &&dec, &&halt };
+  int acc = 0;
+  goto *dispatch[*code++];
+inc:
+  ++acc;
+  goto *dispatch[*code++];
+dec:
+  --acc;
+  goto *dispatch[*code++];
+halt:
+  return acc;
+}
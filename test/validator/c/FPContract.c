@@ -0,0 +1,14 @@
+// RUN: %eggdragon -O2 -mfma -S %s -o - | FileCheck %s
+// RUN: %eggdragon -O2 -mfma -ffp-contract=off -S %s -o - | FileCheck %s --check-prefix=OFF
+// XFAIL: gcc-4.5, gcc-4.6, i386, i486, i586, i686
+
+// CHECK: muladd
+// CHECK: vfmadd
+// OFF: muladd
+// OFF-NOT: vfmadd
+// OFF: vmulsd
+// OFF: vaddsd
+double muladd(double a, double b, double c) {
+  double t = a * b;
+  return t + c;
+}
@@ -0,0 +1,15 @@
+// RUN: %dragonegg -S %s -o - | FileCheck %s
+// RUN: %dragonegg -S %s -o - -ffast-math | FileCheck %s --check-prefix=FAST
+// XFAIL: gcc-4.5
+
+// CHECK: define double @plain({{.*}}) [[PLAIN:#[0-9]+]]
+// FAST: define double @plain({{.*}}) [[PLAIN:#[0-9]+]]
+double plain(double x, double y) { return x + y; }
+
+// CHECK: define double @fast({{.*}}) [[FAST:#[0-9]+]]
+__attribute__((optimize("fast-math")))
+double fast(double x, double y) { return x + y; }
+
+// CHECK: attributes [[PLAIN]] = { {{.*}}"less-precise-fpmad"="false"{{.*}}"unsafe-fp-math"="false"
+// CHECK: attributes [[FAST]] = { {{.*}}"less-precise-fpmad"="true"{{.*}}"no-infs-fp-math"="true"{{.*}}"unsafe-fp-math"="true"
+// FAST: attributes [[PLAIN]] = { {{.*}}"no-nans-fp-math"="true"{{.*}}"unsafe-fp-math"="true"
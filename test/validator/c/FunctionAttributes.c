@@ -0,0 +1,29 @@
+// RUN: %dragonegg -S %s -o - | FileCheck %s
+
+extern void *first_nonnull(void *, void *) __attribute__((nonnull(2)));
+extern void *all_nonnull(void *, int, void *) __attribute__((nonnull));
+extern void cold_fn(void) __attribute__((cold));
+extern void hot_fn(void) __attribute__((hot));
+void callee(void);
+
+// CHECK: @flattened
+// CHECK: call void @callee() [[FLAT:#[0-9]+]]
+__attribute__((flatten)) void flattened(void) {
+  callee();
+}
+
+void use(void *p, void *q) {
+  first_nonnull(p, q);
+  all_nonnull(p, 0, q);
+  cold_fn();
+  hot_fn();
+}
+
+// CHECK: declare i8* @first_nonnull(i8*, i8* nonnull)
+// CHECK: declare i8* @all_nonnull(i8* nonnull, i32, i8* nonnull)
+// CHECK: declare void @cold_fn() [[COLD:#[0-9]+]]
+// CHECK: declare void @hot_fn() [[HOT:#[0-9]+]]
+
+// CHECK: attributes [[FLAT]] = { alwaysinline
+// CHECK: attributes [[COLD]] = { cold
+// CHECK: attributes [[HOT]] = { inlinehint
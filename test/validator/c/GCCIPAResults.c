@@ -0,0 +1,17 @@
+// RUN: %dragonegg -S %s -o - -O2 -fplugin-arg-dragonegg-enable-gcc-optzns -fplugin-arg-dragonegg-llvm-ir-optimize=0 | FileCheck %s
+// XFAIL: gcc-4.5
+
+// Never written, so GCC's IPA passes discover that it is readonly.
+// CHECK: @table = internal constant [4 x i32] zeroinitializer
+static int table[4];
+
+// CHECK: define i32 @twice(i32 %x) [[CONST:#[0-9]+]]
+__attribute__((noinline)) int twice(int x) {
+  return 2 * x;
+}
+
+int lookup(int i) {
+  return table[i & 3] + twice(i);
+}
+
+// CHECK: attributes [[CONST]] = { {{.*}}readnone
@@ -0,0 +1,13 @@
+// RUN: %dragonegg -S %s -o - -O2 -fplugin-arg-dragonegg-gcc-passes=ccp,fre,ivopts | FileCheck %s
+// Check that the loop optimizers still get their loop structures when only
+// some GCC passes are selected.
+
+int sum(int *a, int n) {
+  int s = 0;
+  int i;
+  for (i = 0; i < n; ++i)
+    s += a[i];
+  return s;
+}
+// CHECK-LABEL: define i32 @sum
+// CHECK: ret i32
@@ -0,0 +1,8 @@
+// RUN: %dragonegg -S %s -o - -fplugin-arg-dragonegg-profile-icall-generate=%t.prof | FileCheck %s
+// CHECK: @llvm.global_dtors {{.*}} @dragonegg.icall.write
+
+int apply(int (*f)(int), int x) {
+// CHECK: @apply
+// CHECK: call void @dragonegg.icall.record
+  return f(x);
+}
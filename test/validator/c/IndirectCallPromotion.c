@@ -0,0 +1,26 @@
+// RUN: printf '\103\111\105\104\001\000\000\000\001\000\000\000\000\000\000\000' > %t.prof
+// RUN: printf '\001\000\000\000\001\000\000\000' >> %t.prof
+// RUN: printf '\000\020\000\000\000\000\000\000\057\300\036\307\145\354\014\263' >> %t.prof
+// RUN: printf '\344\133\254\137\164\250\025\074' >> %t.prof
+// RUN: printf '\000\020\000\000\000\000\000\000\350\003\000\000\000\000\000\000' >> %t.prof
+// RUN: printf '\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000' >> %t.prof
+// RUN: printf '\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000' >> %t.prof
+// RUN: printf '\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000' >> %t.prof
+// RUN: printf '\012\000\000\000\000\000\000\000' >> %t.prof
+// RUN: %dragonegg -S %s -o - -fplugin-arg-dragonegg-profile-icall-use=%t.prof | FileCheck %s
+// XFAIL: powerpc
+// The profile above is a single run in which the function "square" was at
+// address 0x1000, and the indirect call in "apply" called it 1000 times and
+// other functions 10 times.  Check that the call to square is made directly.
+
+int square(int x) {
+  return x * x;
+}
+
+int apply(int (*f)(int), int x) {
+// CHECK: @apply
+// CHECK: icmp eq i32 (i32)* %{{[^ ]+}}, @square
+// CHECK: call i32 @square(
+// CHECK: call i32 %
+  return f(x);
+}
@@ -0,0 +1,37 @@
+// RUN: %dragonegg -S %s -o - -fPIC | FileCheck %s --check-prefix=PIC
+// RUN: %dragonegg -S %s -o - -fPIC -fplugin-arg-dragonegg-no-semantic-interposition | FileCheck %s
+// RUN: %dragonegg -S %s -o - -fpie | FileCheck %s
+// RUN: %eggdragon -S %s -o - -fPIC -fplugin-arg-dragonegg-no-plt | FileCheck %s --check-prefix=NOPLT
+// XFAIL: i386, i486, i586, i686
+
+extern void external(void);
+
+int counter = 0;
+
+void defined(void) {
+  ++counter;
+}
+
+__attribute__((weak)) void weak(void) {}
+
+void caller(void) {
+  defined();
+  weak();
+  external();
+}
+
+// PIC-NOT: localalias
+// CHECK-DAG: @counter.localalias = private alias i32* @counter
+// CHECK-DAG: @defined.localalias = private alias void ()* @defined
+// CHECK-NOT: @weak.localalias
+// CHECK: load i32* @counter.localalias
+// CHECK: call void @defined.localalias()
+// CHECK: call void @weak()
+// CHECK: call void @external()
+
+// NOPLT-LABEL: caller:
+// NOPLT-NOT: external@PLT
+// NOPLT: .Lexternal.got(%rip)
+// NOPLT-NOT: external@PLT
+// NOPLT: .Lexternal.got:
+// NOPLT-NEXT: .quad external
@@ -0,0 +1,30 @@
+// RUN: %dragonegg -S %s -o - | FileCheck %s
+// Check that values returned in multiple registers are stored with the
+// alignment of the destination, and that complex numbers returned in
+// registers of the right type are used directly.
+// XFAIL: i386, i486, i586, i686
+
+struct Pair { long a; long b; };
+
+struct Pair make_pair(void);
+_Complex double make_complex(void);
+
+long sum_pair(void) {
+// CHECK: define i64 @sum_pair
+// CHECK: call { i64, i64 } @make_pair
+// CHECK: store i64 {{.*}}, align 8
+// CHECK: store i64 {{.*}}, align 8
+  struct Pair p = make_pair();
+  return p.a + p.b;
+}
+
+double real_part(void) {
+// CHECK-LABEL: define double @real_part
+// CHECK-NOT: alloca
+// CHECK: [[C:%[^ ]+]] = call { double, double } @make_complex
+// CHECK-NOT: alloca
+// CHECK: extractvalue { double, double } [[C]], 0
+// CHECK-NOT: alloca
+// CHECK: ret double
+  return __real__ make_complex();
+}
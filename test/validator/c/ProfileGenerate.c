@@ -0,0 +1,8 @@
+// RUN: %dragonegg -S %s -o - -fprofile-generate | FileCheck %s
+// CHECK: @__llvm_profile_counters_max = {{.*}} [3 x i64]
+
+int max(int a, int b) {
+// CHECK: @max
+// CHECK: load {{.*}} @__llvm_profile_counters_max
+  return a > b ? a : b;
+}
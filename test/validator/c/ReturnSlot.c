@@ -0,0 +1,40 @@
+// RUN: %dragonegg -S %s -o - | FileCheck %s
+// Check that a large aggregate returned via a hidden pointer is written
+// straight into its destination when the callee cannot otherwise reach it.
+
+struct Big { int a[64]; };
+
+struct Big make(int);
+struct Big remake(struct Big *);
+
+int sum(int x) {
+// CHECK: define i32 @sum
+// CHECK-NOT: llvm.memcpy
+// CHECK: ret i32
+  struct Big b;
+  b = make(x);
+  return b.a[0] + b.a[63];
+}
+
+struct Outer { int tag; struct Big inner; };
+
+int sum_field(int x) {
+// CHECK: define i32 @sum_field
+// CHECK-NOT: llvm.memcpy
+// CHECK: ret i32
+  struct Outer s;
+  s.tag = x;
+  s.inner = make(x);
+  return s.tag + s.inner.a[0] + s.inner.a[63];
+}
+
+int sum_escaping(void) {
+// CHECK: define i32 @sum_escaping
+// CHECK: call void @remake
+// CHECK: llvm.memcpy
+// CHECK: ret i32
+  struct Big b;
+  b.a[0] = 0;
+  b = remake(&b);
+  return b.a[0] + b.a[63];
+}
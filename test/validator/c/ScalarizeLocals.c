@@ -0,0 +1,19 @@
+// RUN: %dragonegg -O1 -fplugin-arg-dragonegg-llvm-ir-optimize=0 -S %s -o - | FileCheck %s
+
+struct pair { int first; long second; };
+
+long sum(int n, struct pair *out) {
+// CHECK: @sum
+// CHECK-NOT: alloca
+// CHECK: ret
+  struct pair p = { 0, 0 };
+  struct pair q;
+  int i;
+  for (i = 0; i < n; ++i) {
+    p.first += i;
+    p.second += p.first;
+  }
+  q = p;
+  *out = q;
+  return q.second;
+}
@@ -0,0 +1,11 @@
+// RUN: %dragonegg -S -g -gsplit-dwarf %s -o %t.ll
+// RUN: FileCheck %s < %t.ll
+// XFAIL: gcc-4.5, gcc-4.6, gcc-4.7
+// Check that with -gsplit-dwarf the compile unit names the file that the .dwo
+// sections are moved to, which GCC bases on the output file name.
+
+// CHECK: !"0x11\00{{.*}}SplitDwarf.c.tmp.dwo\00
+
+int split(int x) {
+  return x + 1;
+}
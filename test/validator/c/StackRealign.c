@@ -0,0 +1,30 @@
+// RUN: %dragonegg -S %s -o - | FileCheck %s
+// RUN: %eggdragon -O1 -S %s -o - | FileCheck %s --check-prefix=ASM
+// RUN: %dragonegg -S -mpreferred-stack-boundary=5 -mincoming-stack-boundary=4 %s -o - | FileCheck %s --check-prefix=INCOMING
+// RUN: %eggdragon -O1 -S -mpreferred-stack-boundary=5 -mincoming-stack-boundary=4 %s -o - | FileCheck %s --check-prefix=INCOMING-ASM
+// XFAIL: arm, powerpc
+
+void bar(char *);
+
+// CHECK: define void @realigned() [[REALIGN:#[0-9]+]]
+// ASM: realigned:
+// ASM: {{and[lq]}} $-16, %{{[er]}}sp
+// ASM: .size realigned
+__attribute__((force_align_arg_pointer)) void realigned(void) {
+  char buf[16] __attribute__ ((aligned (16)));
+  bar(buf);
+}
+
+// If the incoming stack may be less aligned than the stack should be kept for
+// callees then every function realigns it.
+// INCOMING: define void @plain() [[PLAIN:#[0-9]+]]
+// INCOMING-ASM: plain:
+// INCOMING-ASM: {{and[lq]}} $-32, %{{[er]}}sp
+// INCOMING-ASM: .size plain
+void plain(void) {
+  char buf[32];
+  bar(buf);
+}
+
+// CHECK: attributes [[REALIGN]] = { {{.*}}alignstack=16
+// INCOMING: attributes [[PLAIN]] = { {{.*}}alignstack=32
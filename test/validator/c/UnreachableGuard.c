@@ -0,0 +1,26 @@
+// RUN: %dragonegg -S %s -o - -O1 -fplugin-arg-dragonegg-llvm-ir-optimize=0 | FileCheck %s
+
+// CHECK: @guarded
+// CHECK: call void @llvm.assume(i1
+// CHECK-NOT: unreachable
+// CHECK: ret
+int guarded(int x) {
+  if (x < 0)
+    __builtin_unreachable();
+  return x / 4;
+}
+
+extern void fail(void) __attribute__((noreturn));
+
+// CHECK: @checked
+// CHECK: br i1 {{.*}}, !prof [[WEIGHTS:![0-9]+]]
+// CHECK: call void @fail() [[COLD:#[0-9]+]]
+// CHECK: ret
+int checked(int x) {
+  if (x == 0)
+    fail();
+  return 100 / x;
+}
+
+// CHECK: attributes [[COLD]] = { cold
+// CHECK: [[WEIGHTS]] = {{(metadata )?}}!{{{(metadata )?}}!"branch_weights", i32 1, i32 1048575}
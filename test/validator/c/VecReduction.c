@@ -0,0 +1,16 @@
+// RUN: %dragonegg -S %s -o - -O3 -msse2 -ffast-math -fplugin-arg-dragonegg-enable-gcc-optzns | FileCheck %s
+// Check that reductions from the GCC vectorizer are expressed by repeatedly
+// combining the vector with its top half, like the LLVM vectorizers do.
+
+float sum(const float *a) {
+// CHECK: define float @sum
+// CHECK: shufflevector <4 x float> [[V:%[^ ]+]], <4 x float> undef, <4 x i32> <i32 2, i32 3, i32 undef, i32 undef>
+// CHECK: fadd {{.*}}<4 x float> [[V]],
+// CHECK: shufflevector <4 x float> [[W:%[^ ]+]], <4 x float> undef, <4 x i32> <i32 1, i32 undef, i32 undef, i32 undef>
+// CHECK: fadd {{.*}}<4 x float> [[W]],
+  float s = 0;
+  int i;
+  for (i = 0; i < 64; ++i)
+    s += a[i];
+  return s;
+}
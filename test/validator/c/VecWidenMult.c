@@ -0,0 +1,21 @@
+// RUN: %dragonegg -S %s -o - -O3 -msse2 -fplugin-arg-dragonegg-enable-gcc-optzns | FileCheck %s
+// Check that widening vector multiplies from the GCC vectorizer are done with
+// the SSE multiplies that produce wide results.
+
+void smul16(int *__restrict out, const short *__restrict a,
+            const short *__restrict b) {
+// CHECK: define void @smul16
+// CHECK: @llvm.x86.sse2.pmulh.w
+  int i;
+  for (i = 0; i < 64; ++i)
+    out[i] = a[i] * b[i];
+}
+
+void umul16(unsigned *__restrict out, const unsigned short *__restrict a,
+            const unsigned short *__restrict b) {
+// CHECK: define void @umul16
+// CHECK: @llvm.x86.sse2.pmulhu.w
+  int i;
+  for (i = 0; i < 64; ++i)
+    out[i] = (unsigned)a[i] * b[i];
+}
@@ -0,0 +1,10 @@
+// RUN: %eggdragon -S %s -o - -O2 -march=x86-64 -mcx16 | FileCheck %s
+// XFAIL: i386, i486, i586, i686
+// Check that -mcx16 is passed on to LLVM, including by GCC versions that do
+// not record it in the instruction set flags.
+
+int swap(__int128 *p, __int128 old, __int128 new_value) {
+// CHECK: swap:
+// CHECK: cmpxchg16b
+  return __sync_bool_compare_and_swap(p, old, new_value);
+}
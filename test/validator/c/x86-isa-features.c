@@ -0,0 +1,30 @@
+// RUN: %eggdragon -S %s -o - -O2 -mbmi -mbmi2 -mlzcnt -mavx2 | FileCheck %s
+// XFAIL: gcc-4.5, gcc-4.6
+// Check that the instruction set extensions asked for on the command line are
+// used.
+
+unsigned shift(unsigned x, unsigned n) {
+// CHECK: shift:
+// CHECK: shlx
+  return x << n;
+}
+
+unsigned trailing(unsigned x) {
+// CHECK: trailing:
+// CHECK: tzcnt
+  return __builtin_ctz(x);
+}
+
+unsigned leading(unsigned x) {
+// CHECK: leading:
+// CHECK: lzcnt
+  return __builtin_clz(x);
+}
+
+typedef int v8si __attribute__((vector_size(32)));
+
+v8si add(v8si a, v8si b) {
+// CHECK: add:
+// CHECK: vpaddd {{.*}}%ymm
+  return a + b;
+}
@@ -0,0 +1,24 @@
+// RUN: %eggdragon -S %s -o - -O2 -march=x86-64 -mtune=core-avx2 | FileCheck %s
+// XFAIL: gcc-4.5, gcc-4.6, i386, i486, i586, i686
+// Check that tuning for a processor does not enable its instruction set.
+
+typedef int v8si __attribute__((vector_size(32)));
+
+v8si add(v8si a, v8si b) {
+// CHECK: add:
+// CHECK-NOT: ymm
+  return a + b;
+}
+
+unsigned trailing(unsigned x) {
+// CHECK: trailing:
+// CHECK-NOT: tzcnt
+  return __builtin_ctz(x);
+}
+
+unsigned clear_lowest(unsigned x) {
+// CHECK: clear_lowest:
+// CHECK-NOT: blsr
+// CHECK: ret
+  return x & (x - 1);
+}